@@ -0,0 +1,45 @@
+#ifndef ALLOCCOUNT_HPP
+#define ALLOCCOUNT_HPP
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Heap allocation counter. The counting replacements of the global operator new / delete
+// are only defined in the translation unit that includes this header with
+// SHIPESCAPE_ALLOC_COUNTER defined (there must be only one per program); everywhere else
+// AllocCounter::count() just reads the shared counter.
+namespace ShipEscape {
+struct AllocCounter {
+	static std::atomic<size_t> &counter() {
+		static std::atomic<size_t> c{0};
+		return c;
+	}
+	static size_t count() { return counter().load(std::memory_order_relaxed); }
+};
+}
+
+#ifdef SHIPESCAPE_ALLOC_COUNTER
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+// every replacement below pairs malloc with free, which gcc can't see through
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void *operator new(std::size_t n) {
+	ShipEscape::AllocCounter::counter().fetch_add(1, std::memory_order_relaxed);
+	if (void *p = std::malloc(n ? n : 1)) return p;
+	throw std::bad_alloc();
+}
+void *operator new[](std::size_t n) { return operator new(n); }
+void *operator new(std::size_t n, const std::nothrow_t &) noexcept {
+	ShipEscape::AllocCounter::counter().fetch_add(1, std::memory_order_relaxed);
+	return std::malloc(n ? n : 1);
+}
+void *operator new[](std::size_t n, const std::nothrow_t &t) noexcept {
+	return operator new(n, t);
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+#endif
+#endif
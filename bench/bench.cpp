@@ -0,0 +1,498 @@
+#define SHIPESCAPE_ALLOC_COUNTER
+#include "../alloccount.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "../distributed.hpp"
+#include "../replay.hpp"
+#include "../ship.hpp"
+#include "../visibility.hpp"
+#include "../worldbatch.hpp"
+#include "stubcontroller.hpp"
+
+using namespace ShipEscape;
+
+// Micro and macro benchmarks of the headless simulation.
+// usage: shipescape_bench [--time s] [--filter name] [--save file.json]
+//                         [--compare baseline.json] [--tolerance 0.1] [--profile file.json]
+// --profile (builds with SHIPESCAPE_PROFILE only) prints where the time went, per phase, and
+// saves it as JSON. Timings then include the instrumentation overhead.
+
+struct Result {
+	std::string name;
+	double value;
+	std::string unit;
+	bool higherIsBetter;
+};
+
+struct Bench {
+	double minTime = 0.3;  // seconds spent on each measurement
+	std::string filter;
+	std::vector<Result> results;
+
+	bool enabled(const std::string &name) const {
+		return filter.empty() || name.find(filter) != std::string::npos;
+	}
+
+	// average seconds per call of f, calling it until minTime is spent
+	template <typename F> double time(F &&f) {
+		typedef std::chrono::steady_clock clock;
+		f();  // warm-up
+		size_t n = 0;
+		auto t0 = clock::now();
+		double elapsed = 0;
+		do {
+			f();
+			++n;
+			elapsed = std::chrono::duration<double>(clock::now() - t0).count();
+		} while (elapsed < minTime);
+		return elapsed / static_cast<double>(n);
+	}
+
+	void report(const std::string &name, double value, const std::string &unit,
+	            bool higherIsBetter = false) {
+		results.push_back(Result{name, value, unit, higherIsBetter});
+		printf("%-36s %14.2f %s\n", name.c_str(), value, unit.c_str());
+	}
+
+	void save(const std::string &path) const {
+		std::ofstream f(path);
+		f << "{\n  \"results\": [\n";
+		for (size_t i = 0; i < results.size(); ++i) {
+			const Result &r = results[i];
+			char line[512];
+			snprintf(line, sizeof(line),
+			         "    {\"name\": \"%s\", \"value\": %.17g, \"unit\": \"%s\", "
+			         "\"better\": \"%s\"}%s\n",
+			         r.name.c_str(), r.value, r.unit.c_str(), r.higherIsBetter ? "higher" : "lower",
+			         i + 1 < results.size() ? "," : "");
+			f << line;
+		}
+		f << "  ]\n}\n";
+	}
+
+	// returns the number of results worse than the baseline by more than tolerance
+	int compare(const std::string &path, double tolerance) const {
+		std::ifstream f(path);
+		if (!f) {
+			fprintf(stderr, "can't read baseline %s\n", path.c_str());
+			return 1;
+		}
+		int regressions = 0;
+		std::string line;
+		printf("\n%-36s %14s %14s %8s\n", "vs baseline", "baseline", "current", "ratio");
+		while (std::getline(f, line)) {
+			char name[256];
+			double value;
+			if (sscanf(line.c_str(), " {\"name\": \"%255[^\"]\", \"value\": %lf", name, &value) != 2)
+				continue;
+			for (const Result &r : results) {
+				if (r.name != name) continue;
+				double ratio = value != 0 ? r.value / value : 1.0;
+				double gain = r.higherIsBetter ? ratio : (r.value != 0 ? value / r.value : 1.0);
+				bool regression = r.value != value && gain < 1.0 - tolerance;
+				regressions += regression;
+				printf("%-36s %14.2f %14.2f %8.3f%s\n", name, value, r.value, ratio,
+				       regression ? "  REGRESSION" : "");
+			}
+		}
+		return regressions;
+	}
+};
+
+// a world some way into a run of the stub pilot, so that rays see a full obstacle window
+template <typename T = double> static BasicWorld<T> midRunWorld(int steps) {
+	StubController g = shipXP::randomInit<StubController>();
+	const shipXP::Handles<StubController> h(g);
+	BasicWorld<T> w;
+	auto &s = w.ships.at(0);
+	for (int i = 0; i < steps && !w.finished(s); ++i) {
+		BasicV<T> dirs[shipXP::NBLASERS];
+		T dists[shipXP::NBLASERS];
+		w.sensors.directions(s.orientation, dirs);
+		w.castFan(s, dirs, shipXP::NBLASERS, w.MAXH, dists);
+		shipXP::apply(shipXP::step(g, h, s.orientation, dists), s, w.dt);
+		w.update();
+	}
+	return w;
+}
+
+static std::vector<shipXP::Actions> recordActions(int run) {
+	StubController g = shipXP::randomInit<StubController>();
+	std::vector<shipXP::Actions> actions;
+	shipXP::evaluateRun(g, run,
+	                    [&](const World &, const shipXP::Actions &a) { actions.push_back(a); });
+	return actions;
+}
+
+static void benchUpdate(Bench &b) {
+	if (!b.enabled("world_update")) return;
+	auto actions = recordActions(0);
+	size_t allocs = 0;
+	double t = b.time([&]() {
+		World w;
+		auto &s = w.ships.at(0);
+		w.update();
+		size_t a0 = AllocCounter::count();
+		for (size_t i = 1; i < actions.size(); ++i) {
+			shipXP::apply(actions[i], s, w.dt);
+			w.update();
+		}
+		allocs = AllocCounter::count() - a0;
+	});
+	b.report("world_update", t * 1e9 / actions.size(), "ns/step");
+	b.report("world_update_steps", actions.size() / t, "steps/s", true);
+	b.report("world_update_allocs", static_cast<double>(allocs) / actions.size(), "allocs/step");
+}
+
+static void benchRays(Bench &b) {
+	World w = midRunWorld(400);
+	const Ship &s = w.ships.at(0);
+	const int N = 360;
+	std::vector<V> dirs(N);
+	for (int i = 0; i < N; ++i) dirs[i] = V(cos(2.0 * M_PI * i / N), sin(2.0 * M_PI * i / N));
+	V fan[shipXP::NBLASERS];
+	double out[N];
+	w.sensors.directions(s.orientation, fan);
+	const std::pair<RayCasting, std::string> modes[] = {
+	    {RayCasting::window, "window"},
+	    {RayCasting::traversal, "traversal"},
+	    {RayCasting::distanceField, "distancefield"}};
+	for (auto &m : modes) {
+		w.rayCasting = m.first;
+		w.updateObstacles();  // builds the fields in distanceField mode
+		volatile double sink = 0;
+		if (b.enabled("ray_" + m.second)) {
+			double t = b.time([&]() {
+				for (int i = 0; i < N; ++i) sink = sink + w.normalizedDistRay(dirs[i], w.MAXH, s);
+			});
+			b.report("ray_" + m.second, t * 1e9 / N, "ns/ray");
+		}
+		if (b.enabled("fan_" + m.second)) {
+			double t = b.time([&]() {
+				w.castFan(s, fan, shipXP::NBLASERS, w.MAXH, out);
+				sink = sink + out[0];
+			});
+			b.report("fan_" + m.second, t * 1e9, "ns/fan");
+			b.report("fan_" + m.second + "_per_ray", t * 1e9 / shipXP::NBLASERS, "ns/ray");
+		}
+		// the same 11 rays as fan_, one normalizedDistRay each
+		if (b.enabled("fan_" + m.second + "_by_ray")) {
+			double t = b.time([&]() {
+				for (int i = 0; i < shipXP::NBLASERS; ++i)
+					sink = sink + w.normalizedDistRay(fan[i], w.MAXH, s);
+			});
+			b.report("fan_" + m.second + "_by_ray", t * 1e9, "ns/fan");
+		}
+	}
+}
+
+// a controller step's sensing: the default fan, a fan of 33 rays all around the ship, and the
+// same one with the 22 rays outside the front reading half as far and every 4 steps only
+static void benchSensors(Bench &b) {
+	World w = midRunWorld(400);
+	const Ship &s = w.ships.at(0);
+	SensorConfig wide(33, 2.0 * M_PI), decimated(0, 0);
+	for (auto &r : wide.rays) {
+		bool front = fabs(r.angle) <= shipXP::TETA / 2.0;
+		decimated.add(r.angle, front ? 0.0 : w.MAXH / 2.0, front ? 1 : 4);
+	}
+	const std::pair<const SensorConfig *, std::string> configs[] = {
+	    {&w.sensors, "sensors_default"}, {&wide, "sensors_wide"},
+	    {&decimated, "sensors_wide_decimated"}};
+	for (auto &c : configs) {
+		if (!b.enabled(c.second)) continue;
+		SensorReadings<double> readings(*c.first);
+		const int STEPS = 12;
+		volatile double sink = 0;
+		double t = b.time([&]() {
+			for (int k = 0; k < STEPS; ++k) {
+				readings.read(*c.first, s.orientation, w.MAXH,
+				              [&](const V *dirs, size_t n, double m, double *out) {
+					              w.castFan(s, dirs, n, m, out);
+				              });
+				sink = sink + readings.values[0];
+			}
+		});
+		b.report(c.second, t * 1e9 / STEPS, "ns/step");
+	}
+}
+
+// the viewer's light: 1500 rays against the exact visibility polygon, and the same rays sphere
+// tracing the distance fields, at the default and at 16 times the obstacle density. The field
+// rays must hit exactly where the others do. The dense case is the one the fields are for:
+// traversal cost grows with the density and theirs hardly does, so they win there only.
+static void benchLight(Bench &b) {
+	World w = midRunWorld(400);
+	const Ship &s = w.ships.at(0);
+	const int N = 1500;
+	std::vector<V> dirs(N);
+	for (int i = 0; i < N; ++i) dirs[i] = V(cos(2.0 * M_PI * i / N), sin(2.0 * M_PI * i / N));
+	const std::pair<double, std::string> densities[] = {{1.0, ""}, {16.0, "_dense"}};
+	for (auto &dens : densities) {
+		if (!b.enabled("light_rays" + dens.second)) continue;
+		World dw = w;
+		dw.obstacleDensity = w.obstacleDensity * dens.first;
+		dw.obstacles.clear();
+		std::vector<double> exact(N), traced(N);
+		dw.updateObstacles();
+		double t = b.time([&]() { dw.castFan(s, dirs.data(), N, dw.MAXH, exact.data()); });
+		b.report("light_rays" + dens.second, t * 1e6, "us/frame");
+		dw.rayCasting = RayCasting::distanceField;
+		dw.updateObstacles();
+		t = b.time([&]() { dw.castFan(s, dirs.data(), N, dw.MAXH, traced.data()); });
+		b.report("light_rays" + dens.second + "_field", t * 1e6, "us/frame");
+		int mismatches = 0;
+		for (int i = 0; i < N; ++i) mismatches += exact[i] != traced[i];
+		b.report("light_rays" + dens.second + "_field_mismatches", mismatches, "rays");
+	}
+	if (b.enabled("light_visibility")) {
+		Visibility vis;
+		double t = b.time([&]() { vis.compute(w, s, w.MAXH); });
+		b.report("light_visibility", t * 1e6, "us/frame");
+		b.report("light_visibility_points", static_cast<double>(vis.fan.size()), "points");
+	}
+}
+
+static void benchObstacles(Bench &b) {
+	World w = midRunWorld(400);
+	double y = w.ships.at(0).position.y;
+	const std::pair<ObstacleRng, std::string> generators[] = {{ObstacleRng::legacy, ""},
+	                                                          {ObstacleRng::counter, "_counter"}};
+	for (auto &g : generators) {
+		if (!b.enabled("obstacles_cold" + g.second)) continue;
+		w.obstacleRng = g.first;
+		size_t cells = 0;
+		double t = b.time([&]() {
+			World::ObstacleMap obs;
+			w.fillObstacles(obs, y, w.seedOffset, w.ships.at(0).prevReset);
+			cells = obs.size();
+		});
+		b.report("obstacles_cold" + g.second, t * 1e9 / cells, "ns/cell");
+	}
+	w.obstacleRng = World().obstacleRng;
+	if (b.enabled("obstacles_warm")) {
+		double t = b.time([&]() { w.updateObstacles(); });
+		b.report("obstacles_warm", t * 1e9, "ns/call");
+	}
+}
+
+static void benchEvaluate(Bench &b) {
+	if (!b.enabled("evaluate")) return;
+	const int NIND = 8;
+	std::vector<StubIndividual> pop(NIND);
+	for (int i = 0; i < NIND; ++i) {
+		pop[i].dna = shipXP::randomInit<StubController>();
+		pop[i].dna.bias = 0.25 * (i - NIND / 2);
+	}
+	size_t steps = 0, allocs = 0;
+	for (auto &ind : pop) {
+		for (int r = 0; r < shipXP::NRUN; ++r) {
+			size_t a0 = 0, n = 0;
+			shipXP::evaluateRun(ind.dna, r, [&](const World &, const shipXP::Actions &) {
+				if (n++ == 0) a0 = AllocCounter::count();
+			});
+			steps += n;
+			allocs += AllocCounter::count() - a0;
+		}
+	}
+	double t = b.time([&]() {
+		for (auto &ind : pop) shipXP::evaluate(ind);
+	});
+	b.report("evaluate", t * 1e9 / steps, "ns/step");
+	b.report("evaluate_steps", steps / t, "steps/s", true);
+	b.report("evaluate_allocs", static_cast<double>(allocs) / steps, "allocs/step");
+
+	if (b.enabled("evaluate_shared")) {
+		// the same individuals flying together, one world per run
+		ThreadPool pool(1);
+		t = b.time([&]() { shipXP::evaluateShared(pop.begin(), pop.end(), pool); });
+		b.report("evaluate_shared", t * 1e9 / steps, "ns/step");
+	}
+
+	if (b.enabled("evaluate_cached")) {
+		// a generation where the elites and clones of the previous one are looked up again
+		ThreadPool pool(1);
+		FitnessCache cache;
+		shipXP::evaluatePopulation(pop.begin(), pop.end(), pool, cache);
+		t = b.time([&]() { shipXP::evaluatePopulation(pop.begin(), pop.end(), pool, cache); });
+		b.report("evaluate_cached", t * 1e9 / NIND, "ns/individual");
+	}
+
+	if (b.enabled("evaluate_distributed")) {
+		// the same individuals sent in tasks to two local worker processes
+		RemoteEvaluator<StubController> remote;
+		remote.spawnLocal(2);
+		t = b.time([&]() { remote.evaluatePopulation(pop.begin(), pop.end()); });
+		b.report("evaluate_distributed", t * 1e9 / steps, "ns/step");
+	}
+
+	if (!b.enabled("evaluate_recorded")) return;
+	ReplayRecorder rec;
+	size_t bytes = 0;
+	t = b.time([&]() {
+		bytes = 0;
+		for (auto &ind : pop) {
+			for (int r = 0; r < shipXP::NRUN; ++r) {
+				shipXP::evaluateRun(ind.dna, r, rec);
+				bytes += rec.data().size();
+			}
+		}
+	});
+	b.report("evaluate_recorded", t * 1e9 / steps, "ns/step");
+	b.report("replay_size", static_cast<double>(bytes) / steps, "bytes/step");
+}
+
+// cost of a simulated second at coarser time steps (swept collisions keep them from
+// tunnelling) and with the controller deciding less often than the world steps
+static void benchTimestep(Bench &b) {
+	struct Setting {
+		std::string name;
+		double dt;
+		int controlPeriod;
+	};
+	const Setting settings[] = {{"timestep_60hz", 1.0 / 60.0, 1},
+	                            {"timestep_30hz", 1.0 / 30.0, 1},
+	                            {"timestep_20hz", 1.0 / 20.0, 1},
+	                            {"timestep_60hz_control_20hz", 1.0 / 60.0, 3}};
+	const int NIND = 8;
+	std::vector<StubController> pop(NIND);
+	for (int i = 0; i < NIND; ++i) {
+		pop[i] = shipXP::randomInit<StubController>();
+		pop[i].bias = 0.25 * (i - NIND / 2);
+	}
+	for (auto &st : settings) {
+		if (!b.enabled(st.name)) continue;
+		double simulated = 0;
+		double t = b.time([&]() {
+			simulated = 0;
+			for (auto &dna : pop) {
+				for (int r = 0; r < shipXP::NRUN; ++r) {
+					StubController g = dna;
+					World w;
+					w.seedOffset = r * 1000;
+					w.dt = st.dt;
+					w.controlPeriod = st.controlPeriod;
+					shipXP::run(g, w);
+					simulated += w.currentTime;
+				}
+			}
+		});
+		b.report(st.name, t * 1e6 / simulated, "us/sim s");
+	}
+}
+
+// the float world against the double one. The drift is measured open loop: the actions the
+// double run took are replayed in both worlds, so that it is not hidden by a different
+// decision of the pilot. The precision test checks it against the bounds of ship.hpp.
+static void benchPrecision(Bench &b) {
+	if (b.enabled("precision_drift")) {
+		double maxPos = 0, maxRay = 0;
+		for (int r = 0; r < shipXP::NRUN; ++r) {
+			auto actions = recordActions(r);
+			World w;
+			BasicWorld<float> f;
+			w.update();
+			f.update();
+			for (size_t i = 1; i < actions.size(); ++i) {
+				shipXP::apply(actions[i], w.ships[0], w.dt);
+				shipXP::apply(actions[i], f.ships[0], f.dt);
+				w.update();
+				f.update();
+				V dirs[shipXP::NBLASERS];
+				BasicV<float> fdirs[shipXP::NBLASERS];
+				double dists[shipXP::NBLASERS];
+				float fdists[shipXP::NBLASERS];
+				w.sensors.directions(w.ships[0].orientation, dirs);
+				f.sensors.directions(f.ships[0].orientation, fdirs);
+				w.castFan(w.ships[0], dirs, shipXP::NBLASERS, w.MAXH, dists);
+				f.castFan(f.ships[0], fdirs, shipXP::NBLASERS, f.MAXH, fdists);
+				const auto &p = f.ships[0].position;
+				V d = w.ships[0].position - V(p.x, p.y);
+				maxPos = std::max(maxPos, sqrt(d.sqLength()));
+				for (int k = 0; k < shipXP::NBLASERS; ++k)
+					maxRay = std::max(maxRay, std::fabs(dists[k] - fdists[k]));
+			}
+		}
+		b.report("precision_drift_position", maxPos * 1e6, "1e-6 units");
+		b.report("precision_drift_ray", maxRay * 1e6, "1e-6 of range");
+	}
+	if (b.enabled("precision_fitness")) {
+		StubController g = shipXP::randomInit<StubController>();
+		double delta = 0;
+		for (int r = 0; r < shipXP::NRUN; ++r)
+			delta = std::max(delta, std::fabs(shipXP::evaluateRun(g, r) -
+			                                  shipXP::evaluateRun<float>(g, r)));
+		b.report("precision_fitness_delta", delta * 1e6, "1e-6");
+	}
+	if (b.enabled("fan_float")) {
+		BasicWorld<float> w = midRunWorld<float>(400);
+		const auto &s = w.ships.at(0);
+		BasicV<float> fan[shipXP::NBLASERS];
+		float out[shipXP::NBLASERS];
+		w.sensors.directions(s.orientation, fan);
+		volatile float sink = 0;
+		double t = b.time([&]() {
+			w.castFan(s, fan, shipXP::NBLASERS, w.MAXH, out);
+			sink = sink + out[0];
+		});
+		b.report("fan_float", t * 1e9, "ns/fan");
+	}
+}
+
+int main(int argc, char **argv) {
+	Bench b;
+	std::string savePath, comparePath, profilePath;
+	double tolerance = 0.1;
+	for (int i = 1; i < argc; ++i) {
+		std::string a = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (a == "--time" && hasValue)
+			b.minTime = atof(argv[++i]);
+		else if (a == "--filter" && hasValue)
+			b.filter = argv[++i];
+		else if (a == "--save" && hasValue)
+			savePath = argv[++i];
+		else if (a == "--compare" && hasValue)
+			comparePath = argv[++i];
+		else if (a == "--tolerance" && hasValue)
+			tolerance = atof(argv[++i]);
+		else if (a == "--profile" && hasValue && Profiler::enabled())
+			profilePath = argv[++i];
+		else {
+			fprintf(stderr,
+			        "usage: %s [--time s] [--filter name] [--save file.json] "
+			        "[--compare baseline.json] [--tolerance 0.1] [--profile file.json]\n",
+			        argv[0]);
+			return 1;
+		}
+	}
+	printf("ray fan kernel width: %zu (float: %zu)\n", RayKernel::lanes(0.0),
+	       RayKernel::lanes(0.0f));
+	benchUpdate(b);
+	benchRays(b);
+	benchSensors(b);
+	benchLight(b);
+	benchObstacles(b);
+	benchEvaluate(b);
+	benchTimestep(b);
+	benchPrecision(b);
+	if (!profilePath.empty()) {
+		printf("\n");
+		Profiler::table(stdout);
+		FILE *f = fopen(profilePath.c_str(), "w");
+		if (!f) {
+			fprintf(stderr, "can't write %s\n", profilePath.c_str());
+			return 1;
+		}
+		Profiler::json(f);
+		fclose(f);
+	}
+	if (!savePath.empty()) b.save(savePath);
+	if (!comparePath.empty() && b.compare(comparePath, tolerance) > 0) return 2;
+	return 0;
+}
@@ -0,0 +1,114 @@
+#ifndef STUBCONTROLLER_HPP
+#define STUBCONTROLLER_HPP
+#include <map>
+#include <string>
+#include <vector>
+#include "../distributed.hpp"
+#include "../ship.hpp"
+
+namespace ShipEscape {
+
+// Cheap deterministic stand-in for a GRN genome, with the same interface as far as shipXP is
+// concerned. It steers toward the longest laser and thrusts most of the time, which gives
+// runs of realistic length without depending on the genome library.
+struct StubController {
+	enum class ProteinType { input, output, regul };
+	typedef ProteinType ProteinType_t;
+
+	std::map<std::string, size_t> inputIds, outputIds;
+	std::vector<double> inputs, outputs;
+	double bias = 0.0;  // makes individuals differ
+	unsigned int phase = 0;
+
+	void randomParams() {}
+	void randomReguls(size_t) {}
+	void addRandomProtein(ProteinType t, const std::string &name) {
+		if (t == ProteinType::input) {
+			inputIds[name] = inputs.size();
+			inputs.push_back(0);
+		} else if (t == ProteinType::output) {
+			outputIds[name] = outputs.size();
+			outputs.push_back(0);
+		}
+	}
+	void setInputConcentration(const std::string &name, double c) { inputs[inputIds.at(name)] = c; }
+	double getOutputConcentration(const std::string &name) const {
+		return outputs[outputIds.at(name)];
+	}
+
+	void step() {
+		if (out.empty()) {
+			for (auto name : {"l0", "l1", "r0", "r1", "t0", "t1"}) out.push_back(outputIds.at(name));
+			laser0 = inputIds.at("0");
+		}
+		const int n = static_cast<int>(inputs.size() - laser0);  // lasers come last
+		const double *lasers = &inputs[laser0];
+		int best = 0;
+		for (int i = 1; i < n; ++i)
+			if (lasers[i] > lasers[best]) best = i;
+		double steer = (best - (n - 1) * 0.5) + bias;
+		outputs[out[0]] = steer > 0.5;
+		outputs[out[1]] = 0.5;
+		outputs[out[2]] = steer < -0.5;
+		outputs[out[3]] = 0.5;
+		outputs[out[4]] = (++phase % 4) != 0;
+		outputs[out[5]] = 0.5;
+	}
+
+ private:
+	std::vector<size_t> out;  // l0 l1 r0 r1 t0 t1, resolved on the first step
+	size_t laser0 = 0;
+};
+
+// integer handles, so that the benchmarked loop measures the simulation rather than map lookups
+template <> struct ControllerIO<StubController> {
+	typedef size_t Handle;
+	static Handle input(const StubController &g, const std::string &name) {
+		return g.inputIds.at(name);
+	}
+	static Handle output(const StubController &g, const std::string &name) {
+		return g.outputIds.at(name);
+	}
+	static void set(StubController &g, Handle h, double c) { g.inputs[h] = c; }
+	static double get(StubController &g, Handle h) { return g.outputs[h]; }
+};
+
+// the stub has no serialization; what it does only depends on its bias and phase
+template <> struct GenomeHash<StubController> {
+	static uint64_t hash(const StubController &g) {
+		return StableHash().add(g.bias).add(g.phase).value();
+	}
+};
+
+// sent to workers as its bias, phase and number of lasers
+template <> struct GenomeCodec<StubController> {
+	static string encode(const StubController &g) {
+		vector<uint8_t> b;
+		Replay::put(b, g.bias);
+		Replay::put(b, g.phase);
+		Replay::put(b, static_cast<uint32_t>(g.inputs.size() - 2));
+		return string(b.begin(), b.end());
+	}
+	static StubController decode(const string &s) {
+		vector<uint8_t> b(s.begin(), s.end());
+		size_t at = 0;
+		double bias = 0;
+		unsigned int phase = 0;
+		uint32_t nbLasers = SensorConfig::DEFAULT_RAYS;
+		Replay::get(b, at, bias);
+		Replay::get(b, at, phase);
+		Replay::get(b, at, nbLasers);
+		StubController g =
+		    shipXP::randomInit<StubController>(1, SensorConfig(static_cast<int>(nbLasers), 1.0));
+		g.bias = bias;
+		g.phase = phase;
+		return g;
+	}
+};
+
+struct StubIndividual {
+	StubController dna;
+	std::map<std::string, double> fitnesses;
+};
+}
+#endif
@@ -0,0 +1,540 @@
+#ifndef DISTRIBUTED_HPP
+#define DISTRIBUTED_HPP
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "replay.hpp"
+#include "ship.hpp"
+
+namespace ShipEscape {
+
+// How genomes travel between processes. The default sends serialize() and rebuilds the
+// genome from that string, as GRN genomes do; other genomes specialize this.
+template <typename G> struct GenomeCodec {
+	static string encode(const G &g) { return g.serialize(); }
+	static G decode(const string &s) { return G(s); }
+};
+
+// What a worker needs to fly the runs the way the master would: course parameters, the
+// seedOffset of run 0 (run r flies on seedOffset + r * runSpacing, as in shipXP), the number
+// of runs per genome, obstacle generator, collision mode, control period and sensors.
+struct RemoteConfig {
+	Replay::Header world;
+	int32_t nbRuns = shipXP::NRUN;
+	int32_t runSpacing = 1000;
+	uint32_t obstacleRng = 0, collisions = 0;
+	int32_t controlPeriod = 1;
+	double heartbeat = 0.5;  // seconds between two heartbeats of a worker
+	SensorConfig sensors;
+
+	RemoteConfig() { read(World()); }
+	explicit RemoteConfig(const World &w, int runs = shipXP::NRUN) : nbRuns(runs) { read(w); }
+
+	void read(const World &w) {
+		world.read(w);
+		obstacleRng = static_cast<uint32_t>(w.obstacleRng);
+		collisions = static_cast<uint32_t>(w.collisions);
+		controlPeriod = w.controlPeriod;
+		sensors = w.sensors;
+	}
+	// sets w up for run r
+	void apply(World &w, int r) const {
+		world.apply(w);
+		w.seedOffset = world.seedOffset + r * runSpacing;
+		w.obstacleRng = static_cast<ObstacleRng>(obstacleRng);
+		w.collisions = static_cast<Collisions>(collisions);
+		w.controlPeriod = controlPeriod;
+		w.sensors = sensors;
+	}
+
+	void write(vector<uint8_t> &b) const {
+		world.write(b);
+		Replay::put(b, nbRuns);
+		Replay::put(b, runSpacing);
+		Replay::put(b, obstacleRng);
+		Replay::put(b, collisions);
+		Replay::put(b, controlPeriod);
+		Replay::put(b, heartbeat);
+		Replay::put(b, static_cast<uint32_t>(sensors.size()));
+		for (auto &r : sensors.rays) {
+			Replay::put(b, r.angle);
+			Replay::put(b, r.range);
+			Replay::put(b, static_cast<int32_t>(r.period));
+		}
+	}
+	bool parse(const vector<uint8_t> &b, size_t &at) {
+		uint32_t nbRays;
+		if (!world.parse(b, at) || !Replay::get(b, at, nbRuns) ||
+		    !Replay::get(b, at, runSpacing) || !Replay::get(b, at, obstacleRng) ||
+		    !Replay::get(b, at, collisions) || !Replay::get(b, at, controlPeriod) ||
+		    !Replay::get(b, at, heartbeat) || !Replay::get(b, at, nbRays))
+			return false;
+		sensors = SensorConfig(0, 0);
+		for (uint32_t i = 0; i < nbRays; ++i) {
+			double angle, range;
+			int32_t period;
+			if (!Replay::get(b, at, angle) || !Replay::get(b, at, range) ||
+			    !Replay::get(b, at, period))
+				return false;
+			sensors.add(angle, range, period);
+		}
+		return true;
+	}
+};
+
+// Frames of the master / worker protocol over a connected stream socket: u32 payload size,
+// u8 type, payload. Values are in host byte order, like replays.
+//   CONFIG    master -> worker, once: a RemoteConfig
+//   TASK      master -> worker: u64 id, budget (3 doubles), u8 replays, u32 count, then count
+//             genomes as u32 size + GenomeCodec bytes
+//   RESULT    worker -> master: u64 id, u32 count, then per genome f64 fitness, u8 partial,
+//             i32 runs and, if asked for, a u32 size + replay of every run flown
+//   HEARTBEAT worker -> master, every config.heartbeat seconds
+//   QUIT      master -> worker
+struct Wire {
+	enum Type : uint8_t { CONFIG = 'C', TASK = 'T', RESULT = 'R', HEARTBEAT = 'H', QUIT = 'Q' };
+	static const constexpr uint32_t MAX_FRAME = 1u << 30;
+
+	// appends a frame to b
+	static void frame(vector<uint8_t> &b, Type t, const vector<uint8_t> &payload = {}) {
+		Replay::put(b, static_cast<uint32_t>(payload.size()));
+		b.push_back(t);
+		b.insert(b.end(), payload.begin(), payload.end());
+	}
+	// blocking, for workers; false once the peer is gone
+	static bool send(int fd, Type t, const vector<uint8_t> &payload = {}) {
+		vector<uint8_t> b;
+		b.reserve(5 + payload.size());
+		frame(b, t, payload);
+		for (size_t at = 0; at < b.size();) {
+			ssize_t n = ::send(fd, b.data() + at, b.size() - at, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			at += static_cast<size_t>(n);
+		}
+		return true;
+	}
+	static bool recv(int fd, Type &t, vector<uint8_t> &payload) {
+		uint8_t h[5];
+		uint32_t size;
+		if (!readAll(fd, h, 5)) return false;
+		memcpy(&size, h, 4);
+		if (size > MAX_FRAME) return false;
+		t = static_cast<Type>(h[4]);
+		payload.resize(size);
+		return readAll(fd, payload.data(), size);
+	}
+	// takes the first complete frame off the front of a receive buffer: 1 if there was one,
+	// 0 if more bytes are needed, -1 if the stream is garbage
+	static int take(vector<uint8_t> &buffer, Type &t, vector<uint8_t> &payload) {
+		uint32_t size;
+		if (buffer.size() < 5) return 0;
+		memcpy(&size, buffer.data(), 4);
+		if (size > MAX_FRAME) return -1;
+		if (buffer.size() < 5 + static_cast<size_t>(size)) return 0;
+		t = static_cast<Type>(buffer[4]);
+		payload.assign(buffer.begin() + 5, buffer.begin() + 5 + size);
+		buffer.erase(buffer.begin(), buffer.begin() + 5 + size);
+		return 1;
+	}
+
+	static void putBytes(vector<uint8_t> &b, const void *p, size_t n) {
+		Replay::put(b, static_cast<uint32_t>(n));
+		const uint8_t *c = static_cast<const uint8_t *>(p);
+		b.insert(b.end(), c, c + n);
+	}
+	template <typename S> static bool getBytes(const vector<uint8_t> &b, size_t &at, S &s) {
+		uint32_t n;
+		if (!Replay::get(b, at, n) || n > b.size() - at) return false;
+		s.assign(b.begin() + at, b.begin() + at + n);
+		at += n;
+		return true;
+	}
+
+ private:
+	static bool readAll(int fd, uint8_t *p, size_t n) {
+		while (n) {
+			ssize_t r = ::recv(fd, p, n, 0);
+			if (r < 0 && errno == EINTR) continue;
+			if (r <= 0) return false;
+			p += r;
+			n -= static_cast<size_t>(r);
+		}
+		return true;
+	}
+};
+
+// Evaluation of a population by worker processes, on this machine (spawnLocal) or on others
+// (addWorker with a socket connected to a process running serve). The population is cut in
+// tasks of batchSize genomes, and every worker is kept busy with up to `inflight` of them.
+// A worker that hangs up, sends garbage or stays silent for `timeout` seconds (workers send
+// heartbeats while they compute) is lost: its tasks go back to the front of the queue for
+// the others, and a lost local worker is replaced by a new one. Results are stored by
+// position in the population, so they don't depend on which worker flew what, and equal
+// shipXP::evaluatePopulation's for the same configuration and budget.
+// The master never blocks on a worker, which may itself be stuck sending a result: its
+// sockets are non-blocking, and frames a worker hasn't taken yet wait in that worker's
+// buffer until poll says there is room.
+template <typename G> class RemoteEvaluator {
+ public:
+	struct Options {
+		size_t batchSize = 4;  // genomes per task
+		size_t inflight = 2;  // tasks sent to a worker ahead, so it never waits for the next
+		double timeout = 5;  // seconds without a frame before a worker counts as lost
+		int maxAttempts = 3;  // a task sent out more often than that is an error, not bad luck
+		bool respawn = true;  // replace lost local workers
+	};
+	typedef std::chrono::steady_clock clock;
+
+	explicit RemoteEvaluator(const RemoteConfig &c = RemoteConfig(), const Options &o = Options())
+	    : config(c), options(o) {}
+	RemoteEvaluator(const RemoteEvaluator &) = delete;
+	RemoteEvaluator &operator=(const RemoteEvaluator &) = delete;
+	~RemoteEvaluator() {
+		// a worker that doesn't get the quit sees the hang-up
+		for (auto &w : workers) {
+			Wire::frame(w.out, Wire::QUIT);
+			flush(w);
+			close(w.fd);
+		}
+		for (auto &w : workers)
+			if (w.pid > 0) waitpid(w.pid, nullptr, 0);
+	}
+
+	// forks n worker processes connected by socket pairs. Forking copies the whole process,
+	// so spawn them before starting thread pools.
+	void spawnLocal(size_t n) {
+		for (size_t k = 0; k < n; ++k) {
+			int sv[2];
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) throw runtime_error("socketpair failed");
+			pid_t pid = fork();
+			if (pid < 0) {
+				close(sv[0]);
+				close(sv[1]);
+				throw runtime_error("fork failed");
+			}
+			if (pid == 0) {
+				close(sv[0]);
+				for (auto &w : workers) close(w.fd);
+				int code = 1;
+				try {
+					code = serve(sv[1]) ? 0 : 1;
+				} catch (...) {
+				}
+				_exit(code);
+			}
+			close(sv[1]);
+			if (!connect(sv[0], pid)) throw runtime_error("local worker didn't start");
+		}
+	}
+	// takes over fd, a stream socket to a process running serve (e.g. accepted over TCP);
+	// false if the peer is already gone
+	bool addWorker(int fd) { return connect(fd, 0); }
+
+	size_t size() const { return workers.size(); }
+	size_t lostWorkers() const { return nbLost; }
+
+	// evaluates [begin, end) (random access iterators of individuals) and sets their
+	// "distance" fitness. With replays, (*replays)[i * nbRuns + r] is the replay of run r of
+	// individual i (empty for runs the budget skipped).
+	template <typename It>
+	vector<shipXP::EvalResult> evaluatePopulation(
+	    It begin, It end, const shipXP::EvalBudget &budget = shipXP::EvalBudget(),
+	    vector<vector<uint8_t>> *replays = nullptr) {
+		const size_t n = static_cast<size_t>(end - begin);
+		const size_t batch = max<size_t>(1, options.batchSize);
+		const size_t nbTasks = (n + batch - 1) / batch;
+		const size_t nbRuns = static_cast<size_t>(max(0, config.nbRuns));
+		vector<shipXP::EvalResult> results(n);
+		if (replays) replays->assign(n * nbRuns, vector<uint8_t>());
+		// ids are never reused, so results of tasks left over by an interrupted call are
+		// recognized and dropped
+		const uint64_t base = nextTask;
+		nextTask += nbTasks;
+		deque<size_t> pending;
+		for (size_t t = 0; t < nbTasks; ++t) pending.push_back(t);
+		vector<int> attempts(nbTasks);
+		vector<uint8_t> done(nbTasks);
+		size_t remaining = nbTasks;
+		for (auto &w : workers) {
+			w.tasks.clear();
+			w.seen = clock::now();
+		}
+
+		auto task = [&](size_t t) {
+			vector<uint8_t> b;
+			Replay::put(b, base + t);
+			Replay::put(b, budget.targetFitness);
+			Replay::put(b, budget.maxRunFitness);
+			Replay::put(b, budget.stallTime);
+			b.push_back(replays ? 1 : 0);
+			size_t first = t * batch, last = min(n, first + batch);
+			Replay::put(b, static_cast<uint32_t>(last - first));
+			for (size_t i = first; i < last; ++i) {
+				string s = GenomeCodec<G>::encode(begin[i].dna);
+				Wire::putBytes(b, s.data(), s.size());
+			}
+			return b;
+		};
+		auto result = [&](Worker &w, const vector<uint8_t> &b) {
+			size_t at = 0;
+			uint64_t id;
+			uint32_t count;
+			if (!Replay::get(b, at, id) || !Replay::get(b, at, count)) return false;
+			if (id < base || id >= base + nbTasks) return true;  // stale
+			size_t t = static_cast<size_t>(id - base);
+			size_t first = t * batch, last = min(n, first + batch);
+			if (count != last - first) return false;
+			for (size_t i = first; i < last; ++i) {
+				shipXP::EvalResult r;
+				uint8_t partial;
+				int32_t runs;
+				if (!Replay::get(b, at, r.fitness) || !Replay::get(b, at, partial) ||
+				    !Replay::get(b, at, runs) || runs < 0 || static_cast<size_t>(runs) > nbRuns)
+					return false;
+				r.partial = partial;
+				r.runs = runs;
+				for (int k = 0; replays && k < runs; ++k) {
+					vector<uint8_t> rep;
+					if (!Wire::getBytes(b, at, rep)) return false;
+					if (!done[t]) (*replays)[i * nbRuns + k].swap(rep);
+				}
+				if (!done[t]) results[i] = r;
+			}
+			if (!done[t]) --remaining;
+			done[t] = 1;
+			w.tasks.erase(std::remove(w.tasks.begin(), w.tasks.end(), t), w.tasks.end());
+			return true;
+		};
+		auto lose = [&](Worker &w) {
+			for (size_t t : w.tasks)
+				if (!done[t]) pending.push_front(t);
+			drop(w);
+		};
+
+		while (remaining) {
+			if (workers.empty()) throw runtime_error("no worker left");
+			for (auto &w : workers) {
+				while (w.fd >= 0 && w.tasks.size() < max<size_t>(1, options.inflight) &&
+				       !pending.empty()) {
+					size_t t = pending.front();
+					pending.pop_front();
+					if (attempts[t]++ >= options.maxAttempts)
+						throw runtime_error("task lost by too many workers");
+					w.tasks.push_back(t);
+					Wire::frame(w.out, Wire::TASK, task(t));
+				}
+				if (w.fd >= 0 && !flush(w)) lose(w);
+			}
+			prune();
+
+			vector<pollfd> fds;
+			for (auto &w : workers) {
+				short events = w.out.empty() ? POLLIN : POLLIN | POLLOUT;
+				fds.push_back(pollfd{w.fd, events, 0});
+			}
+			int ms = max(1, static_cast<int>(min(options.timeout, config.heartbeat) * 500));
+			if (poll(fds.data(), fds.size(), ms) < 0 && errno != EINTR)
+				throw runtime_error("poll failed");
+			const clock::time_point now = clock::now();
+			for (size_t k = 0; k < workers.size(); ++k) {
+				Worker &w = workers[k];
+				bool ok = true;
+				if (fds[k].revents) ok = flush(w) && receive(w);
+				Wire::Type type;
+				vector<uint8_t> payload;
+				int got;
+				while (ok && (got = Wire::take(w.in, type, payload)) != 0) {
+					w.seen = now;
+					if (got < 0)
+						ok = false;
+					else if (type == Wire::RESULT)
+						ok = result(w, payload);
+					else
+						ok = type == Wire::HEARTBEAT;
+				}
+				if (!ok || std::chrono::duration<double>(now - w.seen).count() > options.timeout)
+					lose(w);
+			}
+			prune();
+		}
+		for (size_t i = 0; i < n; ++i) begin[i].fitnesses["distance"] = results[i].fitness;
+		return results;
+	}
+
+	// worker side: serves tasks on fd, a connected stream socket, until the master says quit
+	// (true) or hangs up. Genomes are flown one after the other while a thread sends the
+	// heartbeats.
+	static bool serve(int fd) {
+		Wire::Type type;
+		vector<uint8_t> in, out;
+		RemoteConfig config;
+		size_t at = 0;
+		if (!Wire::recv(fd, type, in) || type != Wire::CONFIG || !config.parse(in, at))
+			return false;
+		std::mutex sending, m;
+		std::condition_variable wake;
+		bool stop = false;
+		std::thread heart([&]() {
+			const std::chrono::duration<double> period(config.heartbeat);
+			for (;;) {
+				{
+					std::unique_lock<std::mutex> lk(m);
+					if (wake.wait_for(lk, period, [&]() { return stop; })) return;
+				}
+				std::lock_guard<std::mutex> lk(sending);
+				if (!Wire::send(fd, Wire::HEARTBEAT)) return;
+			}
+		});
+		bool ok;
+		while ((ok = Wire::recv(fd, type, in)) && type == Wire::TASK) {
+			if (!(ok = runTask(config, in, out))) break;
+			std::lock_guard<std::mutex> lk(sending);
+			if (!(ok = Wire::send(fd, Wire::RESULT, out))) break;
+		}
+		{
+			std::lock_guard<std::mutex> lk(m);
+			stop = true;
+		}
+		wake.notify_all();
+		heart.join();
+		close(fd);
+		return ok && type == Wire::QUIT;
+	}
+
+ private:
+	struct Worker {
+		int fd;
+		pid_t pid;  // 0 if not a local worker
+		vector<uint8_t> in;  // bytes received, not yet framed
+		vector<uint8_t> out;  // frames queued, not sent yet
+		vector<size_t> tasks;  // sent and not answered yet
+		clock::time_point seen;
+	};
+	RemoteConfig config;
+	Options options;
+	vector<Worker> workers;
+	uint64_t nextTask = 0;
+	size_t nbLost = 0, toSpawn = 0;
+
+	bool connect(int fd, pid_t pid) {
+		vector<uint8_t> b;
+		config.write(b);
+		Worker w{fd, pid, {}, {}, {}, clock::now()};
+		Wire::frame(w.out, Wire::CONFIG, b);
+		int flags = fcntl(fd, F_GETFL, 0);
+		if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0 || !flush(w)) {
+			close(fd);
+			if (pid > 0) {
+				kill(pid, SIGKILL);
+				waitpid(pid, nullptr, 0);
+			}
+			return false;
+		}
+		workers.push_back(std::move(w));
+		return true;
+	}
+	// sends as much of the queued frames as the socket takes, false if the worker hung up
+	bool flush(Worker &w) {
+		size_t at = 0;
+		while (at < w.out.size()) {
+			ssize_t r = ::send(w.fd, w.out.data() + at, w.out.size() - at, MSG_NOSIGNAL);
+			if (r > 0) {
+				at += static_cast<size_t>(r);
+				continue;
+			}
+			if (r < 0 && errno == EINTR) continue;
+			if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+			return false;
+		}
+		w.out.erase(w.out.begin(), w.out.begin() + at);
+		return true;
+	}
+	// reads whatever has arrived, false if the worker hung up
+	bool receive(Worker &w) {
+		uint8_t chunk[1 << 16];
+		for (;;) {
+			ssize_t r = ::recv(w.fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+			if (r > 0) {
+				w.in.insert(w.in.end(), chunk, chunk + r);
+				continue;
+			}
+			if (r < 0 && errno == EINTR) continue;
+			return r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
+	}
+	void drop(Worker &w) {
+		if (w.fd < 0) return;
+		close(w.fd);
+		w.fd = -1;
+		w.tasks.clear();
+		++nbLost;
+		if (w.pid > 0) {
+			kill(w.pid, SIGKILL);
+			waitpid(w.pid, nullptr, 0);
+			if (options.respawn) ++toSpawn;
+		}
+	}
+	// forgets lost workers and replaces the local ones
+	void prune() {
+		workers.erase(std::remove_if(workers.begin(), workers.end(),
+		                             [](const Worker &w) { return w.fd < 0; }),
+		              workers.end());
+		size_t n = toSpawn;
+		toSpawn = 0;
+		spawnLocal(n);
+	}
+
+	static bool runTask(const RemoteConfig &config, const vector<uint8_t> &in,
+	                    vector<uint8_t> &out) {
+		size_t at = 0;
+		uint64_t id;
+		shipXP::EvalBudget budget;
+		uint8_t withReplays;
+		uint32_t count;
+		if (!Replay::get(in, at, id) || !Replay::get(in, at, budget.targetFitness) ||
+		    !Replay::get(in, at, budget.maxRunFitness) || !Replay::get(in, at, budget.stallTime) ||
+		    !Replay::get(in, at, withReplays) || !Replay::get(in, at, count))
+			return false;
+		out.clear();
+		Replay::put(out, id);
+		Replay::put(out, count);
+		const int nbRuns = config.nbRuns;
+		auto setup = [&](World &w, int r) { config.apply(w, r); };
+		vector<ReplayRecorder> recorders(withReplays ? static_cast<size_t>(max(0, nbRuns)) : 0);
+		for (uint32_t k = 0; k < count; ++k) {
+			string s;
+			if (!Wire::getBytes(in, at, s)) return false;
+			const G dna = GenomeCodec<G>::decode(s);
+			shipXP::EvalResult res;
+			if (withReplays) {
+				auto recorder = [&](int r) -> ReplayRecorder & { return recorders[r]; };
+				res = shipXP::evaluateRuns(dna, budget, nbRuns, setup, recorder);
+			} else {
+				res = shipXP::evaluateRuns(dna, budget, nbRuns, setup);
+			}
+			Replay::put(out, res.fitness);
+			Replay::put(out, static_cast<uint8_t>(res.partial));
+			Replay::put(out, static_cast<int32_t>(res.runs));
+			for (int r = 0; withReplays && r < res.runs; ++r)
+				Wire::putBytes(out, recorders[r].data().data(), recorders[r].data().size());
+		}
+		return true;
+	}
+};
+}
+#endif
@@ -0,0 +1,125 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../replay.hpp"
+#include "../ship.hpp"
+#include "../threadpool.hpp"
+#include "scene.hpp"
+
+using namespace ShipEscape;
+
+// Renders a replay to video without a display or a GPU: the scene of the viewer (light,
+// ship, obstacles, walls, doors and score, see scene.hpp) is drawn by a CPU rasterizer,
+// frames are rendered in parallel and written in order.
+// usage: shipescape_export replay.bin [--out path] [--format ppm|raw] [--size 800x800]
+//                          [--fps 60] [--threads n]
+//   ppm: one out/frame_000000.ppm per frame (out: an existing directory, "frames" by default)
+//   raw: a single rgb24 stream to out ("-" for stdout), e.g. for
+//        ffmpeg -f rawvideo -pix_fmt rgb24 -s 800x800 -r 60 -i out video.mp4
+
+struct Options {
+	std::string replay, out, format = "ppm";
+	int width = 800, height = 800, threads = 0;
+	double fps = 60;
+};
+
+static bool parse(int argc, char **argv, Options &opt) {
+	for (int i = 1; i < argc; ++i) {
+		std::string a = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (a == "--out" && hasValue)
+			opt.out = argv[++i];
+		else if (a == "--format" && hasValue)
+			opt.format = argv[++i];
+		else if (a == "--size" && hasValue)
+			sscanf(argv[++i], "%dx%d", &opt.width, &opt.height);
+		else if (a == "--fps" && hasValue)
+			opt.fps = atof(argv[++i]);
+		else if (a == "--threads" && hasValue)
+			opt.threads = atoi(argv[++i]);
+		else if (a[0] != '-' && opt.replay.empty())
+			opt.replay = a;
+		else
+			return false;
+	}
+	if (opt.out.empty()) opt.out = opt.format == "raw" ? "-" : "frames";
+	return !opt.replay.empty() && (opt.format == "ppm" || opt.format == "raw") &&
+	       opt.width > 0 && opt.height > 0 && opt.fps > 0;
+}
+
+int main(int argc, char **argv) {
+	Options opt;
+	if (!parse(argc, argv, opt)) {
+		fprintf(stderr,
+		        "usage: %s replay.bin [--out path] [--format ppm|raw] [--size 800x800] "
+		        "[--fps 60] [--threads n]\n",
+		        argv[0]);
+		return 1;
+	}
+	ReplayPlayer player;
+	if (!player.load(opt.replay)) {
+		fprintf(stderr, "can't read replay %s\n", opt.replay.c_str());
+		return 1;
+	}
+	FILE *raw = nullptr;
+	if (opt.format == "raw") {
+		raw = opt.out == "-" ? stdout : fopen(opt.out.c_str(), "wb");
+		if (!raw) {
+			fprintf(stderr, "can't write %s\n", opt.out.c_str());
+			return 1;
+		}
+	}
+
+	ThreadPool pool(static_cast<size_t>(opt.threads));
+	// frames are played back in order, a chunk at a time, then rendered in parallel. States
+	// share their obstacle cells, so holding a chunk of them is cheap.
+	const size_t chunk = 4 * std::max<size_t>(1, pool.size());
+	std::vector<FrameState> states;
+	std::vector<Frame> frames(chunk);
+	std::vector<std::vector<uint8_t>> masks(chunk);
+	for (auto &f : frames) f.resize(opt.width, opt.height);
+	const World &w = player.world;
+	Camera camera{w.ships.at(0).position.x, w.ships.at(0).position.y};
+	const double frameTime = 1.0 / opt.fps;
+	size_t frameCount = 0;
+	bool ended = false;
+	while (!ended) {
+		states.clear();
+		while (states.size() < chunk && !ended) {
+			// the state at frameCount / fps seconds
+			size_t step = static_cast<size_t>(frameCount * frameTime / player.timeStep() + 0.5);
+			while (player.position() < step && player.advance()) {}
+			ended = player.done();
+			camera.follow(w.ships.at(0).position.x, w.ships.at(0).position.y, w.dt);
+			states.push_back(FrameState{w.snapshot(), camera.x, camera.y});
+			++frameCount;
+		}
+		pool.run(states.size(), [&](size_t k) {
+			World fw = w.fork();
+			fw.restore(states[k].state);
+			renderFrame(fw, states[k], frames[k], masks[k]);
+		});
+		for (size_t k = 0; k < states.size(); ++k) {
+			size_t index = frameCount - states.size() + k;
+			const std::vector<uint8_t> &rgb = frames[k].rgb;
+			if (raw) {
+				if (fwrite(rgb.data(), 1, rgb.size(), raw) != rgb.size()) {
+					fprintf(stderr, "write error\n");
+					return 1;
+				}
+			} else {
+				char name[32];
+				snprintf(name, sizeof(name), "/frame_%06zu.ppm", index);
+				if (!frames[k].writePPM(opt.out + name)) {
+					fprintf(stderr, "can't write %s%s\n", opt.out.c_str(), name);
+					return 1;
+				}
+			}
+		}
+	}
+	if (raw && raw != stdout) fclose(raw);
+	fprintf(stderr, "%zu frames of %dx%d\n", frameCount, opt.width, opt.height);
+	return 0;
+}
@@ -0,0 +1,176 @@
+#ifndef RASTER_HPP
+#define RASTER_HPP
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Minimal CPU rasterizer for the exporter: an RGB frame buffer, a world to pixel mapping and
+// the few shapes the viewer's shaders draw, with the same gradients. Colors are blended in
+// floating point and stored as 8 bit RGB, ready to be written as PPM or raw rgb24 video.
+
+struct Color {
+	float r, g, b, a;
+	Color mix(const Color &o, float t) const {  // same as GLSL mix(*this, o, t)
+		return Color{r + (o.r - r) * t, g + (o.g - g) * t, b + (o.b - b) * t, a + (o.a - a) * t};
+	}
+};
+
+struct Frame {
+	int width = 0, height = 0;
+	std::vector<uint8_t> rgb;
+	// world window shown: x from left, y from top down, worldPerPixel world units per pixel
+	double left = 0, top = 0, worldPerPixel = 1;
+
+	void resize(int w, int h) {
+		width = w;
+		height = h;
+		rgb.resize(static_cast<size_t>(w) * h * 3);
+	}
+	// camera centered on (cx, cy), showing viewHeight world units vertically
+	void lookAt(double cx, double cy, double viewHeight) {
+		worldPerPixel = viewHeight / height;
+		left = cx - 0.5 * width * worldPerPixel;
+		top = cy + 0.5 * viewHeight;
+	}
+	double toX(double x) const { return (x - left) / worldPerPixel; }
+	double toY(double y) const { return (top - y) / worldPerPixel; }
+	// world position of the center of pixel (i, j)
+	double worldX(int i) const { return left + (i + 0.5) * worldPerPixel; }
+	double worldY(int j) const { return top - (j + 0.5) * worldPerPixel; }
+
+	void clear(const Color &c) {
+		uint8_t v[3] = {toByte(c.r), toByte(c.g), toByte(c.b)};
+		for (size_t i = 0; i < rgb.size(); i += 3) std::copy(v, v + 3, &rgb[i]);
+	}
+	void blend(int i, int j, const Color &c, float coverage = 1.0f) {
+		float a = std::min(std::max(c.a * coverage, 0.0f), 1.0f);
+		if (a <= 0) return;
+		uint8_t *p = &rgb[(static_cast<size_t>(j) * width + i) * 3];
+		p[0] = toByte(c.r * a + p[0] / 255.0f * (1.0f - a));
+		p[1] = toByte(c.g * a + p[1] / 255.0f * (1.0f - a));
+		p[2] = toByte(c.b * a + p[2] / 255.0f * (1.0f - a));
+	}
+
+	// axis aligned world rectangle, colored c1 to c2 from left to right (plain.frag). Empty
+	// ones, such as a door fully open, draw nothing.
+	void rect(double x0, double y0, double x1, double y1, const Color &c1, const Color &c2) {
+		int i0, i1, j0, j1;
+		if (x0 == x1 || y0 == y1) return;
+		if (!pixelBox(min(x0, x1), min(y0, y1), max(x0, x1), max(y0, y1), i0, j0, i1, j1)) return;
+		for (int i = i0; i <= i1; ++i) {
+			Color c = c1.mix(c2, static_cast<float>((worldX(i) - x0) / (x1 - x0)));
+			for (int j = j0; j <= j1; ++j) blend(i, j, c);
+		}
+	}
+
+	// disc colored c1 at the center to c2 at the rim, by squared distance (circle.frag), with
+	// an antialiased edge
+	void circle(double cx, double cy, double r, const Color &c1, const Color &c2) {
+		int i0, i1, j0, j1;
+		if (!pixelBox(cx - r, cy - r, cx + r, cy + r, i0, j0, i1, j1)) return;
+		double rp = r / worldPerPixel;
+		for (int j = j0; j <= j1; ++j) {
+			double dy = worldY(j) - cy;
+			for (int i = i0; i <= i1; ++i) {
+				double dx = worldX(i) - cx;
+				double l = (dx * dx + dy * dy) / (r * r);
+				if (l > 1.0) {
+					// outside, but within a pixel of the rim: partial coverage
+					double out = (sqrt(l) - 1.0) * rp;
+					if (out < 0.5) blend(i, j, c2, static_cast<float>(0.5 - out));
+					continue;
+				}
+				float coverage = static_cast<float>(std::min(1.0, (1.0 - sqrt(l)) * rp + 0.5));
+				blend(i, j, c1.mix(c2, static_cast<float>(l)), coverage);
+			}
+		}
+	}
+
+	// calls f(i, j) for every pixel whose center lies in the world triangle abc. Shared edges
+	// follow the top-left rule, so the triangles of a fan never cover a pixel twice.
+	template <typename F>
+	void triangle(double ax, double ay, double bx, double by, double cx, double cy, F &&f) {
+		double x[3] = {toX(ax), toX(bx), toX(cx)}, y[3] = {toY(ay), toY(by), toY(cy)};
+		double area = edge(x[0], y[0], x[1], y[1], x[2], y[2]);
+		if (area == 0) return;
+		if (area < 0) {
+			std::swap(x[1], x[2]);
+			std::swap(y[1], y[2]);
+		}
+		int i0 = std::max(0, static_cast<int>(floor(min3(x))));
+		int i1 = std::min(width - 1, static_cast<int>(ceil(max3(x))));
+		int j0 = std::max(0, static_cast<int>(floor(min3(y))));
+		int j1 = std::min(height - 1, static_cast<int>(ceil(max3(y))));
+		bool topLeft[3];
+		for (int e = 0; e < 3; ++e) {
+			int n = (e + 1) % 3;
+			double ex = x[n] - x[e], ey = y[n] - y[e];
+			topLeft[e] = (ey == 0 && ex > 0) || ey < 0;
+		}
+		for (int j = j0; j <= j1; ++j) {
+			double py = j + 0.5;
+			for (int i = i0; i <= i1; ++i) {
+				double px = i + 0.5;
+				bool inside = true;
+				for (int e = 0; e < 3 && inside; ++e) {
+					int n = (e + 1) % 3;
+					double w = edge(x[e], y[e], x[n], y[n], px, py);
+					inside = w > 0 || (w == 0 && topLeft[e]);
+				}
+				if (inside) f(i, j);
+			}
+		}
+	}
+
+	// digits, '-' and ' ' from a 3x5 font, each font pixel drawn as size x size pixels,
+	// centered on pixel (cx, cy)
+	void text(const std::string &s, int cx, int cy, int size, const Color &c) {
+		static const uint16_t glyphs[11] = {
+		    075557, 022222, 071747, 071717, 055711, 074717, 074757, 071111, 075757, 075717, 000700};
+		int x0 = cx - (static_cast<int>(s.size()) * 4 - 1) * size / 2, y0 = cy - 5 * size / 2;
+		for (size_t k = 0; k < s.size(); ++k) {
+			int g = s[k] == '-' ? 10 : (s[k] >= '0' && s[k] <= '9' ? s[k] - '0' : -1);
+			if (g < 0) continue;
+			for (int row = 0; row < 5; ++row)
+				for (int col = 0; col < 3; ++col) {
+					if (!((glyphs[g] >> ((4 - row) * 3 + 2 - col)) & 1)) continue;
+					int px = x0 + (static_cast<int>(k) * 4 + col) * size, py = y0 + row * size;
+					for (int j = std::max(0, py); j < std::min(height, py + size); ++j)
+						for (int i = std::max(0, px); i < std::min(width, px + size); ++i) blend(i, j, c);
+				}
+		}
+	}
+
+	bool writePPM(const std::string &path) const {
+		FILE *f = fopen(path.c_str(), "wb");
+		if (!f) return false;
+		fprintf(f, "P6\n%d %d\n255\n", width, height);
+		bool ok = fwrite(rgb.data(), 1, rgb.size(), f) == rgb.size();
+		return fclose(f) == 0 && ok;
+	}
+
+ private:
+	static uint8_t toByte(float v) {
+		return static_cast<uint8_t>(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f);
+	}
+	static double min(double a, double b) { return a < b ? a : b; }
+	static double max(double a, double b) { return a > b ? a : b; }
+	static double min3(const double *v) { return min(v[0], min(v[1], v[2])); }
+	static double max3(const double *v) { return max(v[0], max(v[1], v[2])); }
+	static double edge(double ax, double ay, double bx, double by, double px, double py) {
+		return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+	}
+	// pixels covering a world box, false if none
+	bool pixelBox(double x0, double y0, double x1, double y1, int &i0, int &j0, int &i1,
+	              int &j1) const {
+		i0 = std::max(0, static_cast<int>(floor(toX(x0))));
+		i1 = std::min(width - 1, static_cast<int>(floor(toX(x1))));
+		j0 = std::max(0, static_cast<int>(floor(toY(y1))));
+		j1 = std::min(height - 1, static_cast<int>(floor(toY(y0))));
+		return i0 <= i1 && j0 <= j1;
+	}
+};
+#endif
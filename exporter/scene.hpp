@@ -0,0 +1,106 @@
+#ifndef SCENE_HPP
+#define SCENE_HPP
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "../ship.hpp"
+#include "../visibility.hpp"
+#include "raster.hpp"
+
+namespace ShipEscape {
+
+// The viewer's scene (light, ship, obstacles, walls, doors and score) drawn by the CPU
+// rasterizer, one frame at a time.
+
+// what a frame needs: the world state at that instant and where the camera is
+struct FrameState {
+	World::State state;
+	double cameraX, cameraY;
+};
+
+// the viewer's smooth camera, advanced once per frame
+struct Camera {
+	double x, y, prevL = 0;
+	void follow(double tx, double ty, double dt) {
+		const double K = 200;
+		const double C = 0.01;
+		double dx = tx - x, dy = ty - y;
+		double L = sqrt(dx * dx + dy * dy);
+		double speed = (L - prevL) / dt;
+		prevL = L;
+		x += (dx * K - speed * C * dx) * dt * dt;
+		y += (dy * K - speed * C * dy) * dt * dt;
+	}
+};
+
+inline void renderFrame(const World &w, const FrameState &fs, Frame &frame,
+                        std::vector<uint8_t> &lightMask) {
+	frame.lookAt(fs.cameraX, fs.cameraY, w.MAXH);
+	frame.clear(Color{0.05f, 0.12f, 0.24f, 1.0f});
+
+	// ship lights, as LightRenderer: the fan is first rasterized into a mask so that the
+	// light is blended once per pixel
+	const Color light1{0.1f, 0.24f, 0.48f, 0.2f}, light2{0.05f, 0.12f, 0.24f, 0.0f};
+	Visibility vis;
+	vis.tolerance = frame.worldPerPixel;
+	for (auto &s : w.ships) {
+		const double maxDist = w.MAXH;
+		const auto &fan = vis.compute(w, s, maxDist);
+		const size_t width = static_cast<size_t>(frame.width);
+		lightMask.assign(frame.rgb.size() / 3, 0);
+		for (size_t k = 2; k < fan.size(); ++k)
+			frame.triangle(fan[0].x, fan[0].y, fan[k - 1].x, fan[k - 1].y, fan[k].x, fan[k].y,
+			               [&](int i, int j) { lightMask[j * width + i] = 1; });
+		for (int j = 0; j < frame.height; ++j)
+			for (int i = 0; i < frame.width; ++i) {
+				if (!lightMask[j * width + i]) continue;
+				double dx = frame.worldX(i) - s.position.x, dy = frame.worldY(j) - s.position.y;
+				float t = static_cast<float>(std::min(sqrt(dx * dx + dy * dy) / maxDist, 1.0));
+				frame.blend(i, j, light1.mix(light2, t));
+			}
+	}
+
+	// the ship, as a triangle the size of its sprite
+	const Color hull{0.85f, 0.88f, 0.92f, 1.0f};
+	for (auto &s : w.ships) {
+		V f = s.orientation, side(-f.y, f.x);
+		V nose = s.position + f * s.dimensions.y;
+		V backL = s.position - f * s.dimensions.y + side * s.dimensions.x;
+		V backR = s.position - f * s.dimensions.y - side * s.dimensions.x;
+		frame.triangle(nose.x, nose.y, backL.x, backL.y, backR.x, backR.y,
+		               [&](int i, int j) { frame.blend(i, j, hull); });
+	}
+
+	// obstacles
+	const Color o1{1, 0.7f, 0.5f, 1}, o2{1, 0.9f, 0.6f, 1};
+	int gridCell = w.getGridPosition(fs.cameraY);
+	int visibility = w.gridVisibility();
+	for (int c = gridCell - visibility; c <= gridCell + visibility; ++c)
+		if (auto *cell = w.obstacles.find(c))
+			for (auto &o : *cell) frame.circle(o.center.x, o.center.y, o.radius, o1, o2);
+
+	// walls
+	const double wallWidth = 50;
+	const Color w1{0.07f, 0.3f, 0.48f, 1}, w2{0.12f, 0.5f, 0.34f, 1};
+	double bottom = fs.cameraY - w.MAXH, top = fs.cameraY + w.MAXH;
+	frame.rect(-2.0 * wallWidth, bottom, 0, top, w1, w2);
+	frame.rect(w.W, bottom, w.W + 2.0 * wallWidth, top, w2, w1);
+
+	// doors of the followed ship
+	const double doorThickness = 0.3;
+	const Color d1{0.97f, 0, 0.32f, 1}, d2{0.98f, 0.8f, 0.3f, 1};
+	const Doors d = w.doors(w.ships.at(0));
+	frame.rect(0, d.prevReset - 2.0 * doorThickness, w.W, d.prevReset + 2.0 * doorThickness, d2,
+	           d2);
+	frame.rect(0, d.nextReset - doorThickness, d.closedSize, d.nextReset + doorThickness, d2, d1);
+	frame.rect(w.W - d.closedSize, d.nextReset - doorThickness, w.W, d.nextReset + doorThickness,
+	           d1, d2);
+
+	// score
+	int score = static_cast<int>(w.ships.at(0).position.y);
+	frame.text(std::to_string(score), frame.width / 2, static_cast<int>(frame.height * 0.9),
+	           std::max(2, frame.height / 100), Color{1, 1, 1, 1});
+}
+}
+#endif
@@ -0,0 +1,182 @@
+#ifndef FITNESSCACHE_HPP
+#define FITNESSCACHE_HPP
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace ShipEscape {
+
+// 64 bit FNV-1a. Unlike std::hash, values are the same in every run and build, so they can
+// be stored.
+struct StableHash {
+	uint64_t h = 14695981039346656037ull;
+
+	StableHash &bytes(const void *p, size_t n) {
+		const uint8_t *b = static_cast<const uint8_t *>(p);
+		for (size_t i = 0; i < n; ++i) h = (h ^ b[i]) * 1099511628211ull;
+		return *this;
+	}
+	template <typename T> StableHash &add(const T &v) {
+		static_assert(std::is_trivially_copyable<T>::value, "hash values, not objects");
+		return bytes(&v, sizeof(T));
+	}
+	StableHash &add(const std::string &s) {
+		add(static_cast<uint64_t>(s.size()));
+		return bytes(s.data(), s.size());
+	}
+	uint64_t value() const { return h; }
+};
+
+// How the fitness cache identifies a genome. The default hashes its serialization, which
+// holds the parameters, proteins and regulations of a GRN. Genomes without serialize(), or
+// with a cheaper stable identity, can specialize this.
+template <typename G> struct GenomeHash {
+	static uint64_t hash(const G &g) { return StableHash().add(g.serialize()).value(); }
+};
+
+// Bounded LRU cache of evaluation results, keyed by the hash of a genome and of everything
+// its evaluation depends on (see shipXP::evaluationKey). Worlds are deterministic, so a hit
+// is exactly what simulating again would give. Every call locks, so the cache can be shared
+// by concurrent evaluations. save / load keep it across runs of an experiment.
+class FitnessCache {
+ public:
+	struct Entry {
+		double fitness = 0;
+		int32_t runs = 0;
+		uint8_t partial = 0;
+	};
+	static const char *magic() { return "SEXC"; }
+	static const constexpr uint32_t VERSION = 1;
+
+	explicit FitnessCache(size_t capacity = 1 << 16) : maxSize(capacity) {}
+	FitnessCache(const FitnessCache &) = delete;
+	FitnessCache &operator=(const FitnessCache &) = delete;
+
+	// copies the entry of key to e and marks it as most recently used
+	bool find(uint64_t key, Entry &e) {
+		std::lock_guard<std::mutex> lock(m);
+		auto it = index.find(key);
+		if (it == index.end()) {
+			++nbMisses;
+			return false;
+		}
+		order.splice(order.begin(), order, it->second);
+		e = it->second->second;
+		++nbHits;
+		return true;
+	}
+	// adds or replaces the entry of key, evicting the least recently used one if full
+	void insert(uint64_t key, const Entry &e) {
+		std::lock_guard<std::mutex> lock(m);
+		put(key, e);
+	}
+
+	size_t size() const {
+		std::lock_guard<std::mutex> lock(m);
+		return order.size();
+	}
+	size_t capacity() const { return maxSize; }
+	size_t hits() const {
+		std::lock_guard<std::mutex> lock(m);
+		return nbHits;
+	}
+	size_t misses() const {
+		std::lock_guard<std::mutex> lock(m);
+		return nbMisses;
+	}
+	void clear() {
+		std::lock_guard<std::mutex> lock(m);
+		order.clear();
+		index.clear();
+	}
+
+	// magic, version, count, then (key, fitness, runs, partial) from least to most recently
+	// used, in host byte order
+	bool save(const std::string &path) const {
+		std::vector<uint8_t> b;
+		{
+			std::lock_guard<std::mutex> lock(m);
+			b.insert(b.end(), magic(), magic() + 4);
+			putValue(b, static_cast<uint32_t>(VERSION));
+			putValue(b, static_cast<uint64_t>(order.size()));
+			for (auto it = order.rbegin(); it != order.rend(); ++it) {
+				putValue(b, it->first);
+				putValue(b, it->second.fitness);
+				putValue(b, it->second.runs);
+				putValue(b, it->second.partial);
+			}
+		}
+		std::ofstream f(path, std::ios::binary);
+		f.write(reinterpret_cast<const char *>(b.data()), b.size());
+		return static_cast<bool>(f);
+	}
+	// adds the entries of a saved cache, as the most recently used ones. Leaves the cache
+	// untouched if the file can't be read.
+	bool load(const std::string &path) {
+		std::ifstream f(path, std::ios::binary);
+		if (!f) return false;
+		std::vector<uint8_t> b((std::istreambuf_iterator<char>(f)),
+		                       std::istreambuf_iterator<char>());
+		size_t at = 4;
+		uint32_t version;
+		uint64_t n;
+		if (b.size() < 4 || memcmp(b.data(), magic(), 4)) return false;
+		if (!getValue(b, at, version) || version != VERSION || !getValue(b, at, n)) return false;
+		std::vector<std::pair<uint64_t, Entry>> entries;
+		for (uint64_t i = 0; i < n; ++i) {
+			std::pair<uint64_t, Entry> e;
+			if (!getValue(b, at, e.first) || !getValue(b, at, e.second.fitness) ||
+			    !getValue(b, at, e.second.runs) || !getValue(b, at, e.second.partial))
+				return false;
+			entries.push_back(e);
+		}
+		std::lock_guard<std::mutex> lock(m);
+		for (auto &e : entries) put(e.first, e.second);
+		return true;
+	}
+
+ private:
+	typedef std::list<std::pair<uint64_t, Entry>> Order;
+	mutable std::mutex m;
+	size_t maxSize;
+	Order order;  // most recently used first
+	std::unordered_map<uint64_t, Order::iterator> index;
+	size_t nbHits = 0, nbMisses = 0;
+
+	void put(uint64_t key, const Entry &e) {
+		auto it = index.find(key);
+		if (it != index.end()) {
+			it->second->second = e;
+			order.splice(order.begin(), order, it->second);
+			return;
+		}
+		if (!maxSize) return;
+		if (order.size() >= maxSize) {
+			index.erase(order.back().first);
+			order.pop_back();
+		}
+		order.emplace_front(key, e);
+		index[key] = order.begin();
+	}
+
+	template <typename T> static void putValue(std::vector<uint8_t> &b, const T &v) {
+		const uint8_t *p = reinterpret_cast<const uint8_t *>(&v);
+		b.insert(b.end(), p, p + sizeof(T));
+	}
+	template <typename T>
+	static bool getValue(const std::vector<uint8_t> &b, size_t &at, T &v) {
+		if (at + sizeof(T) > b.size()) return false;
+		memcpy(&v, &b[at], sizeof(T));
+		at += sizeof(T);
+		return true;
+	}
+};
+}
+#endif
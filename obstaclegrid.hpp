@@ -0,0 +1,94 @@
+#ifndef OBSTACLEGRID_HPP
+#define OBSTACLEGRID_HPP
+#include <climits>
+#include <memory>
+#include <vector>
+
+namespace ShipEscape {
+
+// Fixed-capacity window of grid cells. Cell n lives in slot n mod capacity, so a window of
+// at most capacity consecutive cells never collides and a new cell ahead simply takes over
+// the slot of the one that fell behind. Slots keep their storage, so once every slot has
+// been filled once, generating cells no longer allocates.
+// Copies share their cells until one of them changes, which then gets its own storage
+// (copy on write), so snapshots and forks of a world are cheap.
+template <typename T> struct ObstacleGrid {
+	static const constexpr int EMPTY = INT_MIN;
+
+	ObstacleGrid(size_t capacity = 0) : data(std::make_shared<Storage>()) {
+		setCapacity(capacity);
+	}
+
+	size_t capacity() const { return data->contents.size(); }
+	// perSlot reserves room in every slot so that filling cells never allocates
+	void setCapacity(size_t c, size_t perSlot = 0) {
+		detach();
+		data->keys.assign(c, int(EMPTY));
+		data->contents.resize(c);
+		for (auto &s : data->contents) {
+			s.clear();
+			s.reserve(perSlot);
+		}
+	}
+
+	size_t slot(int cell) const {
+		int c = static_cast<int>(capacity());
+		return static_cast<size_t>(((cell % c) + c) % c);
+	}
+	bool count(int cell) const { return capacity() && data->keys[slot(cell)] == cell; }
+	// contents of a cell, or nullptr if it is not in the window
+	const std::vector<T> *find(int cell) const {
+		if (!capacity()) return nullptr;
+		size_t s = slot(cell);
+		return data->keys[s] == cell ? &data->contents[s] : nullptr;
+	}
+	// evicts whatever occupies the cell's slot and hands back its (emptied) storage
+	std::vector<T> &insert(int cell) {
+		detach();
+		size_t s = slot(cell);
+		data->keys[s] = cell;
+		data->contents[s].clear();
+		return data->contents[s];
+	}
+	void erase(int cell) {
+		if (!count(cell)) return;
+		detach();
+		data->keys[slot(cell)] = EMPTY;
+	}
+	void clear() {
+		detach();
+		for (auto &k : data->keys) k = EMPTY;
+	}
+	size_t size() const {
+		size_t n = 0;
+		for (auto k : data->keys) n += k != EMPTY;
+		return n;
+	}
+	// whether the cells are currently shared with another copy
+	bool shared() const { return data.use_count() > 1; }
+	// copies o's cells into this grid's own storage, reused from the last copy. Unlike an
+	// assignment, nothing is shared, so neither grid copies on its next change.
+	void copyFrom(const ObstacleGrid &o) {
+		if (shared()) data = std::make_shared<Storage>();
+		data->keys = o.data->keys;
+		data->contents.resize(o.data->contents.size());
+		for (size_t s = 0; s < data->contents.size(); ++s) {
+			// as much room as the source, so that later copies fit
+			data->contents[s].reserve(o.data->contents[s].capacity());
+			if (o.data->keys[s] != EMPTY) data->contents[s] = o.data->contents[s];
+		}
+	}
+
+ private:
+	struct Storage {
+		std::vector<int> keys;  // cell held by each slot, EMPTY if none
+		std::vector<std::vector<T>> contents;  // storage of each slot
+	};
+	std::shared_ptr<Storage> data;
+
+	void detach() {
+		if (data.use_count() > 1) data = std::make_shared<Storage>(*data);
+	}
+};
+}
+#endif
@@ -0,0 +1,70 @@
+#ifndef PHILOX_HPP
+#define PHILOX_HPP
+#include <cstddef>
+#include <cstdint>
+
+namespace ShipEscape {
+
+// Philox4x32-10 counter based generator (Salmon et al., "Parallel random numbers: as easy as
+// 1, 2, 3"). A 128 bit counter is mixed under a 64 bit key into 128 random bits, so any block
+// of the stream is computed directly from its counter, and for a given key distinct counters
+// never give the same block. Streams of different keys are independent.
+struct Philox {
+	static const constexpr uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+	static const constexpr uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+	static const constexpr int ROUNDS = 10;
+
+	// block of counter (c0, c1, c2, c3) under key (k0, k1), written to out[0..3]
+	static void block(uint32_t k0, uint32_t k1, uint32_t c0, uint32_t c1, uint32_t c2,
+	                  uint32_t c3, uint32_t *out) {
+		for (int r = 0; r < ROUNDS; ++r) {
+			round(k0, k1, c0, c1, c2, c3);
+			k0 += W0;
+			k1 += W1;
+		}
+		out[0] = c0;
+		out[1] = c1;
+		out[2] = c2;
+		out[3] = c3;
+	}
+
+	// n consecutive blocks of counters (c0, c1 + i, 0, 0), i < n, as structure of arrays:
+	// word w of block i goes to out[w][i]. Blocks are computed side by side in plain loops
+	// the compiler vectorizes.
+	static void blocks(uint32_t k0, uint32_t k1, uint32_t c0, uint32_t c1, size_t n,
+	                   uint32_t *const out[4]) {
+		uint32_t *__restrict x0 = out[0];
+		uint32_t *__restrict x1 = out[1];
+		uint32_t *__restrict x2 = out[2];
+		uint32_t *__restrict x3 = out[3];
+		for (size_t i = 0; i < n; ++i) {
+			x0[i] = c0;
+			x1[i] = c1 + static_cast<uint32_t>(i);
+			x2[i] = 0;
+			x3[i] = 0;
+		}
+		for (int r = 0; r < ROUNDS; ++r) {
+			for (size_t i = 0; i < n; ++i) round(k0, k1, x0[i], x1[i], x2[i], x3[i]);
+			k0 += W0;
+			k1 += W1;
+		}
+	}
+
+	// uniform double in [0, 1) from 32 random bits
+	static double uniform(uint32_t u) { return u * (1.0 / 4294967296.0); }
+
+ private:
+	static void round(uint32_t k0, uint32_t k1, uint32_t &c0, uint32_t &c1, uint32_t &c2,
+	                  uint32_t &c3) {
+		uint64_t p0 = static_cast<uint64_t>(M0) * c0;
+		uint64_t p1 = static_cast<uint64_t>(M1) * c2;
+		uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+		uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+		c1 = static_cast<uint32_t>(p1);
+		c3 = static_cast<uint32_t>(p0);
+		c0 = n0;
+		c2 = n2;
+	}
+};
+}
+#endif
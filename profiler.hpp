@@ -0,0 +1,191 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+// Hot path instrumentation: scoped timers per simulation phase and event counters. Each thread
+// accumulates into its own slots without locking; they are merged when the summary is read
+// and folded into the totals when the thread exits.
+// The SHIPESCAPE_PROFILE_* macros only expand to something when SHIPESCAPE_PROFILE is defined;
+// otherwise they vanish along with their arguments, so instrumented code costs exactly nothing.
+namespace ShipEscape {
+struct Profiler {
+	enum Phase { RAYS, CONTROLLER, PHYSICS, OBSTACLES, COLLISIONS, RUN, NB_PHASES };
+	enum Counter {
+		RAYS_CAST,
+		CIRCLES_TESTED,
+		CELLS_GENERATED,
+		OBSTACLE_CELLS,
+		STEPS,
+		NB_COUNTERS
+	};
+	// whether the SHIPESCAPE_PROFILE_* macros record anything in this build
+	static constexpr bool enabled() {
+#ifdef SHIPESCAPE_PROFILE
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	static const char *name(Phase p) {
+		static const char *names[] = {"rays", "controller", "physics", "obstacles", "collisions",
+		                              "run"};
+		return names[p];
+	}
+	static const char *name(Counter c) {
+		static const char *names[] = {"rays_cast", "circles_tested", "cells_generated",
+		                              "obstacle_cells", "steps"};
+		return names[c];
+	}
+
+	// merged values: time and number of calls per phase, total and number of additions per
+	// counter (so that e.g. obstacle_cells total / samples is the mean size of the window)
+	struct Summary {
+		uint64_t ns[NB_PHASES] = {}, calls[NB_PHASES] = {};
+		uint64_t total[NB_COUNTERS] = {}, samples[NB_COUNTERS] = {};
+	};
+
+	static void time(Phase p, uint64_t ns) {
+		Slots &s = local();
+		bump(s.ns[p], ns);
+		bump(s.calls[p], 1);
+	}
+	static void add(Counter c, uint64_t n) {
+		Slots &s = local();
+		bump(s.total[c], n);
+		bump(s.samples[c], 1);
+	}
+
+	struct Scope {
+		typedef std::chrono::steady_clock clock;
+		Phase phase;
+		clock::time_point t0;
+		explicit Scope(Phase p) : phase(p), t0(clock::now()) {}
+		~Scope() {
+			auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t0);
+			time(phase, static_cast<uint64_t>(ns.count()));
+		}
+	};
+
+	// everything recorded so far, by every thread
+	static Summary summary() {
+		Registry &r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		Summary s = r.retired;
+		for (auto *l : r.live) l->addTo(s);
+		return s;
+	}
+	static void reset() {
+		Registry &r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		r.retired = Summary();
+		for (auto *l : r.live) l->clear();
+	}
+
+	static void table(FILE *f, const Summary &s = summary()) {
+		fprintf(f, "%-16s %12s %12s %12s\n", "phase", "calls", "ms", "ns/call");
+		for (int p = 0; p < NB_PHASES; ++p)
+			fprintf(f, "%-16s %12llu %12.2f %12.1f\n", name(Phase(p)),
+			        static_cast<unsigned long long>(s.calls[p]), s.ns[p] * 1e-6,
+			        s.calls[p] ? static_cast<double>(s.ns[p]) / s.calls[p] : 0.0);
+		fprintf(f, "%-16s %12s %12s %12s\n", "counter", "samples", "total", "mean");
+		for (int c = 0; c < NB_COUNTERS; ++c)
+			fprintf(f, "%-16s %12llu %12llu %12.2f\n", name(Counter(c)),
+			        static_cast<unsigned long long>(s.samples[c]),
+			        static_cast<unsigned long long>(s.total[c]),
+			        s.samples[c] ? static_cast<double>(s.total[c]) / s.samples[c] : 0.0);
+	}
+	static void json(FILE *f, const Summary &s = summary()) {
+		fprintf(f, "{\n  \"phases\": {");
+		for (int p = 0; p < NB_PHASES; ++p)
+			fprintf(f, "%s\n    \"%s\": {\"calls\": %llu, \"ns\": %llu}", p ? "," : "",
+			        name(Phase(p)), static_cast<unsigned long long>(s.calls[p]),
+			        static_cast<unsigned long long>(s.ns[p]));
+		fprintf(f, "\n  },\n  \"counters\": {");
+		for (int c = 0; c < NB_COUNTERS; ++c)
+			fprintf(f, "%s\n    \"%s\": {\"samples\": %llu, \"total\": %llu}", c ? "," : "",
+			        name(Counter(c)), static_cast<unsigned long long>(s.samples[c]),
+			        static_cast<unsigned long long>(s.total[c]));
+		fprintf(f, "\n  }\n}\n");
+	}
+
+ private:
+	// written by their thread only, read by summary(): relaxed atomics are plain loads and
+	// stores on the hot path but keep the reads race free
+	struct Slots {
+		std::atomic<uint64_t> ns[NB_PHASES], calls[NB_PHASES];
+		std::atomic<uint64_t> total[NB_COUNTERS], samples[NB_COUNTERS];
+		Slots() { clear(); }
+		void clear() {
+			for (int p = 0; p < NB_PHASES; ++p) ns[p] = calls[p] = 0;
+			for (int c = 0; c < NB_COUNTERS; ++c) total[c] = samples[c] = 0;
+		}
+		void addTo(Summary &s) const {
+			for (int p = 0; p < NB_PHASES; ++p) {
+				s.ns[p] += ns[p].load(std::memory_order_relaxed);
+				s.calls[p] += calls[p].load(std::memory_order_relaxed);
+			}
+			for (int c = 0; c < NB_COUNTERS; ++c) {
+				s.total[c] += total[c].load(std::memory_order_relaxed);
+				s.samples[c] += samples[c].load(std::memory_order_relaxed);
+			}
+		}
+	};
+	struct Registry {
+		std::mutex mutex;
+		std::vector<Slots *> live;
+		Summary retired;  // slots of the threads that exited
+	};
+
+	static void bump(std::atomic<uint64_t> &a, uint64_t n) {
+		a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+	static Registry &registry() {
+		static Registry r;
+		return r;
+	}
+	static Slots &local() {
+		thread_local Slots *mine = enroll();
+		return *mine;
+	}
+	// the thread's slots are owned by a thread_local holder that retires them at thread exit
+	static Slots *enroll() {
+		struct Holder {
+			Slots own;
+			~Holder() {
+				Registry &r = registry();
+				std::lock_guard<std::mutex> lock(r.mutex);
+				own.addTo(r.retired);
+				for (auto &l : r.live)
+					if (l == &own) l = r.live.back();
+				r.live.pop_back();
+			}
+		};
+		thread_local Holder holder;
+		Registry &r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		r.live.push_back(&holder.own);
+		return &holder.own;
+	}
+};
+}
+
+#ifdef SHIPESCAPE_PROFILE
+#define SHIPESCAPE_PROFILE_CONCAT2(a, b) a##b
+#define SHIPESCAPE_PROFILE_CONCAT(a, b) SHIPESCAPE_PROFILE_CONCAT2(a, b)
+// times the rest of the enclosing block as phase p (a Profiler::Phase)
+#define SHIPESCAPE_PROFILE_SCOPE(p)                                                  \
+	ShipEscape::Profiler::Scope SHIPESCAPE_PROFILE_CONCAT(shipescapeProfile, __LINE__)( \
+	    ShipEscape::Profiler::p)
+// adds n to counter c (a Profiler::Counter)
+#define SHIPESCAPE_PROFILE_COUNT(c, n) ShipEscape::Profiler::add(ShipEscape::Profiler::c, (n))
+#else
+#define SHIPESCAPE_PROFILE_SCOPE(p)
+#define SHIPESCAPE_PROFILE_COUNT(c, n)
+#endif
+#endif
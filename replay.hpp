@@ -0,0 +1,410 @@
+#ifndef REPLAY_HPP
+#define REPLAY_HPP
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "ship.hpp"
+
+namespace ShipEscape {
+
+// Compact binary replays of the run of a world's first ship. A replay stores the obstacle
+// generator and collision mode, the course parameters and seedOffset (obstacles are
+// regenerated, not stored), the initial state, then one record per step:
+//   u8      flags: actuator bits (left, right, thrust) and KEYFRAME
+//   [state] full double precision state after the step, only on keyframes
+//   varints zigzag deltas of the quantized ship position and orientation
+// Worlds are deterministic, so playing the actuators back reproduces the run exactly;
+// keyframes make seeking cheap, the quantized trajectory lets tools read the run without
+// simulating it. Values are stored in host byte order (little endian on the machines we
+// use).
+struct Replay {
+	static const char *magic() { return "SEXR"; }
+	static const constexpr uint32_t VERSION = 1;
+	enum Flags : uint8_t { LEFT = 1, RIGHT = 2, THRUST = 4, KEYFRAME = 8 };
+	static const constexpr double POSITION_QUANTUM = 1.0 / 4096.0;
+	static const constexpr double ORIENTATION_QUANTUM = 1.0 / 32768.0;
+
+	struct Header {
+		int32_t seedOffset = 0;
+		uint32_t keyframeInterval = 256;
+		double W, MAXH, gridSize, obstacleDensity, maxObstaclesRadius, dt, maxCountdown, step,
+		    coefIncrement, rotationSpeed, thrustPower;
+
+		void read(const World &w) {
+			seedOffset = w.seedOffset;
+			W = w.W;
+			MAXH = w.MAXH;
+			gridSize = w.gridSize;
+			obstacleDensity = w.obstacleDensity;
+			maxObstaclesRadius = w.maxObstaclesRadius;
+			dt = w.dt;
+			maxCountdown = w.maxCountdown;
+			step = w.step;
+			coefIncrement = w.coefIncrement;
+			rotationSpeed = w.ships.at(0).rotationSpeed;
+			thrustPower = w.ships.at(0).thrustPower;
+		}
+		void apply(World &w) const {
+			w.seedOffset = seedOffset;
+			w.W = W;
+			w.MAXH = MAXH;
+			w.gridSize = gridSize;
+			w.obstacleDensity = obstacleDensity;
+			w.maxObstaclesRadius = maxObstaclesRadius;
+			w.dt = dt;
+			w.maxCountdown = maxCountdown;
+			w.step = step;
+			w.coefIncrement = coefIncrement;
+			w.ships.at(0).rotationSpeed = rotationSpeed;
+			w.ships.at(0).thrustPower = thrustPower;
+		}
+
+		static const constexpr size_t SIZE = 2 * 4 + 11 * 8;  // encoded
+		void write(std::vector<uint8_t> &b) const {
+			put(b, seedOffset);
+			put(b, keyframeInterval);
+			for (double v : {W, MAXH, gridSize, obstacleDensity, maxObstaclesRadius, dt,
+			                 maxCountdown, step, coefIncrement, rotationSpeed, thrustPower})
+				put(b, v);
+		}
+		bool parse(const std::vector<uint8_t> &b, size_t &at) {
+			return get(b, at, seedOffset) && get(b, at, keyframeInterval) && get(b, at, W) &&
+			       get(b, at, MAXH) && get(b, at, gridSize) && get(b, at, obstacleDensity) &&
+			       get(b, at, maxObstaclesRadius) && get(b, at, dt) && get(b, at, maxCountdown) &&
+			       get(b, at, step) && get(b, at, coefIncrement) && get(b, at, rotationSpeed) &&
+			       get(b, at, thrustPower);
+		}
+	};
+
+	// everything World::update reads and writes, except the obstacles
+	struct Keyframe {
+		double px, py, vx, vy, fx, fy, ox, oy, currentTime, countdown, nextReset, prevReset, coef;
+		uint8_t collided;
+
+		void read(const World &w) {
+			const Ship &s = w.ships.at(0);
+			px = s.position.x;
+			py = s.position.y;
+			vx = s.velocity.x;
+			vy = s.velocity.y;
+			fx = s.forces.x;
+			fy = s.forces.y;
+			ox = s.orientation.x;
+			oy = s.orientation.y;
+			currentTime = w.currentTime;
+			countdown = s.countdown;
+			nextReset = s.nextReset;
+			prevReset = s.prevReset;
+			coef = s.coef;
+			collided = s.collided;
+		}
+		void apply(World &w) const {
+			Ship &s = w.ships.at(0);
+			s.position = V(px, py);
+			s.velocity = V(vx, vy);
+			s.forces = V(fx, fy);
+			s.orientation = V(ox, oy);
+			w.currentTime = currentTime;
+			s.countdown = countdown;
+			s.nextReset = nextReset;
+			s.prevReset = prevReset;
+			s.coef = coef;
+			s.collided = collided;
+			w.obstacles.clear();
+			w.updateObstacles();
+		}
+
+		static const constexpr size_t SIZE = 13 * 8 + 1;  // encoded
+		void write(std::vector<uint8_t> &b) const {
+			for (double v : {px, py, vx, vy, fx, fy, ox, oy, currentTime, countdown, nextReset,
+			                 prevReset, coef})
+				put(b, v);
+			put(b, collided);
+		}
+		bool parse(const std::vector<uint8_t> &b, size_t &at) {
+			if (at + SIZE > b.size()) return false;
+			for (double *v : {&px, &py, &vx, &vy, &fx, &fy, &ox, &oy, &currentTime, &countdown,
+			                  &nextReset, &prevReset, &coef})
+				get(b, at, *v);
+			get(b, at, collided);
+			return true;
+		}
+	};
+
+	template <typename T> static void put(std::vector<uint8_t> &b, const T &v) {
+		const uint8_t *p = reinterpret_cast<const uint8_t *>(&v);
+		b.insert(b.end(), p, p + sizeof(T));
+	}
+	template <typename T> static bool get(const std::vector<uint8_t> &b, size_t &at, T &v) {
+		if (at + sizeof(T) > b.size()) return false;
+		memcpy(&v, &b[at], sizeof(T));
+		at += sizeof(T);
+		return true;
+	}
+	static void putVarint(std::vector<uint8_t> &b, int64_t v) {
+		uint64_t z = (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+		while (z >= 0x80) {
+			b.push_back(static_cast<uint8_t>(z | 0x80));
+			z >>= 7;
+		}
+		b.push_back(static_cast<uint8_t>(z));
+	}
+	static bool getVarint(const std::vector<uint8_t> &b, size_t &at, int64_t &v) {
+		uint64_t z = 0;
+		for (int shift = 0; at < b.size() && shift < 64; shift += 7) {
+			uint8_t c = b[at++];
+			z |= static_cast<uint64_t>(c & 0x7f) << shift;
+			if (!(c & 0x80)) {
+				v = static_cast<int64_t>(z >> 1) ^ -static_cast<int64_t>(z & 1);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static int64_t quantize(double v, double q) { return llround(v / q); }
+};
+
+// Run observer recording a replay: pass it to shipXP::evaluateRun / shipXP::run, which call
+// begin() with the initial world. Each step then costs a few bytes appended to a reserved
+// buffer.
+class ReplayRecorder {
+	std::vector<uint8_t> buffer;
+	int64_t qx = 0, qy = 0, qox = 0, qoy = 0;
+	uint32_t steps = 0;
+	uint32_t keyframeInterval;
+
+ public:
+	explicit ReplayRecorder(uint32_t keyframes = 256, size_t reserveSteps = 1 << 14)
+	    : keyframeInterval(keyframes) {
+		buffer.reserve(128 + reserveSteps * 6);
+	}
+
+	// world is the state *before* the first recorded step
+	void begin(const World &world) {
+		buffer.clear();
+		steps = 0;
+		Replay::Header h;
+		h.read(world);
+		h.keyframeInterval = keyframeInterval;
+		buffer.insert(buffer.end(), Replay::magic(), Replay::magic() + 4);
+		Replay::put(buffer, static_cast<uint32_t>(Replay::VERSION));
+		Replay::put(buffer, static_cast<uint32_t>(world.obstacleRng));
+		Replay::put(buffer, static_cast<uint32_t>(world.collisions));
+		h.write(buffer);
+		Replay::Keyframe k;
+		k.read(world);
+		k.write(buffer);
+		setReference(world.ships.at(0));
+	}
+
+	// observer interface: world after the step, actions that led to it
+	void operator()(const World &world, const shipXP::Actions &a) {
+		bool key = keyframeInterval && (steps + 1) % keyframeInterval == 0;
+		buffer.push_back((a.left ? Replay::LEFT : 0) | (a.right ? Replay::RIGHT : 0) |
+		                 (a.thrust ? Replay::THRUST : 0) | (key ? Replay::KEYFRAME : 0));
+		if (key) {
+			Replay::Keyframe k;
+			k.read(world);
+			k.write(buffer);
+		}
+		const Ship &s = world.ships.at(0);
+		int64_t x = Replay::quantize(s.position.x, Replay::POSITION_QUANTUM);
+		int64_t y = Replay::quantize(s.position.y, Replay::POSITION_QUANTUM);
+		int64_t ox = Replay::quantize(s.orientation.x, Replay::ORIENTATION_QUANTUM);
+		int64_t oy = Replay::quantize(s.orientation.y, Replay::ORIENTATION_QUANTUM);
+		Replay::putVarint(buffer, x - qx);
+		Replay::putVarint(buffer, y - qy);
+		Replay::putVarint(buffer, ox - qox);
+		Replay::putVarint(buffer, oy - qoy);
+		qx = x;
+		qy = y;
+		qox = ox;
+		qoy = oy;
+		++steps;
+	}
+
+	uint32_t size() const { return steps; }
+	const std::vector<uint8_t> &data() const { return buffer; }
+	bool save(const std::string &path) const {
+		std::ofstream f(path, std::ios::binary);
+		f.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+		return static_cast<bool>(f);
+	}
+
+ private:
+	void setReference(const Ship &s) {
+		qx = Replay::quantize(s.position.x, Replay::POSITION_QUANTUM);
+		qy = Replay::quantize(s.position.y, Replay::POSITION_QUANTUM);
+		qox = Replay::quantize(s.orientation.x, Replay::ORIENTATION_QUANTUM);
+		qoy = Replay::quantize(s.orientation.y, Replay::ORIENTATION_QUANTUM);
+	}
+};
+
+// Plays a replay back by re-simulating its actuators in world, with seeking through the
+// keyframes. recordedPosition / recordedOrientation hold the quantized ship state stored for
+// the current step.
+class ReplayPlayer {
+	std::vector<uint8_t> buffer;
+	size_t cursor = 0;   // offset of the next record
+	size_t current = 0;  // steps played
+	size_t nbSteps = 0;
+	size_t firstRecord = 0;
+	int64_t qx = 0, qy = 0, qox = 0, qoy = 0;
+	Replay::Keyframe initial;
+	struct Key {
+		size_t step;    // steps played once the keyframe's record is read
+		size_t offset;  // offset of the record following it
+		Replay::Keyframe state;
+		int64_t qx, qy, qox, qoy;
+	};
+	std::vector<Key> keyframes;
+
+ public:
+	Replay::Header header;
+	ObstacleRng obstacleRng = ObstacleRng::legacy;
+	Collisions collisions = Collisions::discrete;
+	World world;
+	shipXP::Actions actions;  // actuators of the last played step
+	V recordedPosition, recordedOrientation;
+
+	bool load(const std::string &path) {
+		std::ifstream f(path, std::ios::binary);
+		if (!f) return false;
+		std::vector<uint8_t> b((std::istreambuf_iterator<char>(f)),
+		                       std::istreambuf_iterator<char>());
+		return load(std::move(b));
+	}
+
+	bool load(std::vector<uint8_t> data) {
+		buffer = std::move(data);
+		size_t at = 0;
+		uint32_t version, rng, mode;
+		if (buffer.size() < 4 || memcmp(buffer.data(), Replay::magic(), 4)) return false;
+		at = 4;
+		if (!Replay::get(buffer, at, version) || version != Replay::VERSION) return false;
+		if (!Replay::get(buffer, at, rng) || rng > static_cast<uint32_t>(ObstacleRng::legacy))
+			return false;
+		obstacleRng = static_cast<ObstacleRng>(rng);
+		if (!Replay::get(buffer, at, mode) || mode > static_cast<uint32_t>(Collisions::discrete))
+			return false;
+		collisions = static_cast<Collisions>(mode);
+		if (!header.parse(buffer, at) || !initial.parse(buffer, at)) return false;
+		firstRecord = at;
+		// index the keyframes
+		keyframes.clear();
+		nbSteps = 0;
+		int64_t x = quantizedX(initial), y = quantizedY(initial), ox = quantizedOX(initial),
+		        oy = quantizedOY(initial);
+		while (at < buffer.size()) {
+			uint8_t flags = buffer[at++];
+			Replay::Keyframe k;
+			if ((flags & Replay::KEYFRAME) && !k.parse(buffer, at)) return false;
+			int64_t d[4];
+			for (auto &v : d)
+				if (!Replay::getVarint(buffer, at, v)) return false;
+			x += d[0];
+			y += d[1];
+			ox += d[2];
+			oy += d[3];
+			++nbSteps;
+			if (flags & Replay::KEYFRAME) keyframes.push_back(Key{nbSteps, at, k, x, y, ox, oy});
+		}
+		rewind();
+		return true;
+	}
+
+	size_t size() const { return nbSteps; }
+	size_t position() const { return current; }
+	bool done() const { return current >= nbSteps; }
+	double timeStep() const { return header.dt; }
+
+	void rewind() {
+		resetWorld(initial);
+		cursor = firstRecord;
+		current = 0;
+		qx = quantizedX(initial);
+		qy = quantizedY(initial);
+		qox = quantizedOX(initial);
+		qoy = quantizedOY(initial);
+		actions = shipXP::Actions();
+		decodeRecorded();
+	}
+
+	// plays one step, returns false at the end of the replay
+	bool advance() {
+		if (done()) return false;
+		uint8_t flags = buffer[cursor++];
+		if (flags & Replay::KEYFRAME) cursor += Replay::Keyframe::SIZE;
+		int64_t d[4];
+		for (auto &v : d) Replay::getVarint(buffer, cursor, v);
+		qx += d[0];
+		qy += d[1];
+		qox += d[2];
+		qoy += d[3];
+		actions.left = flags & Replay::LEFT;
+		actions.right = flags & Replay::RIGHT;
+		actions.thrust = flags & Replay::THRUST;
+		shipXP::apply(actions, world.ships.at(0), world.dt);
+		world.update();
+		++current;
+		decodeRecorded();
+		return true;
+	}
+
+	// puts the world in the state it had after `step` steps
+	void seek(size_t step) {
+		step = std::min(step, nbSteps);
+		const Key *best = nullptr;
+		for (auto &k : keyframes)
+			if (k.step <= step && (!best || k.step > best->step)) best = &k;
+		if (step < current || (best && best->step > current)) {
+			if (best) {
+				resetWorld(best->state);
+				cursor = best->offset;
+				current = best->step;
+				qx = best->qx;
+				qy = best->qy;
+				qox = best->qox;
+				qoy = best->qoy;
+				decodeRecorded();
+			} else {
+				rewind();
+			}
+		}
+		while (current < step) advance();
+	}
+
+ private:
+	// a fresh world on the replay's course, in the state of keyframe k
+	void resetWorld(const Replay::Keyframe &k) {
+		world.restore(World().snapshot());
+		header.apply(world);
+		world.obstacleRng = obstacleRng;
+		world.collisions = collisions;
+		k.apply(world);
+	}
+
+	static int64_t quantizedX(const Replay::Keyframe &k) {
+		return Replay::quantize(k.px, Replay::POSITION_QUANTUM);
+	}
+	static int64_t quantizedY(const Replay::Keyframe &k) {
+		return Replay::quantize(k.py, Replay::POSITION_QUANTUM);
+	}
+	static int64_t quantizedOX(const Replay::Keyframe &k) {
+		return Replay::quantize(k.ox, Replay::ORIENTATION_QUANTUM);
+	}
+	static int64_t quantizedOY(const Replay::Keyframe &k) {
+		return Replay::quantize(k.oy, Replay::ORIENTATION_QUANTUM);
+	}
+	void decodeRecorded() {
+		recordedPosition = V(qx * Replay::POSITION_QUANTUM, qy * Replay::POSITION_QUANTUM);
+		recordedOrientation =
+		    V(qox * Replay::ORIENTATION_QUANTUM, qoy * Replay::ORIENTATION_QUANTUM);
+	}
+};
+}
+#endif
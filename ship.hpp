@@ -1,46 +1,55 @@
 #ifndef SHIP_HPP
 #define SHIP_HPP
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <limits>
 #include <random>
+#include <type_traits>
 #include <unordered_map>
-
-#ifdef DISPLAY
-#include <QtCore/qmath.h>
-#include <QtGui/QGuiApplication>
-#include <QtGui/QMatrix4x4>
-#include <QtGui/QOpenGLShaderProgram>
-#include <QtGui/QScreen>
-#include "viewer/shipwindow.hpp"
-#endif
+#include <vector>
+#include "fitnesscache.hpp"
+#include "obstaclegrid.hpp"
+#include "philox.hpp"
+#include "profiler.hpp"
+#include "raykernel.hpp"
+#include "threadpool.hpp"
 
 using namespace std;
 
 #define CONTROLE 0.1
 #define FRICTION 0.1
+// keeps gcc's SLP vectorizer off a function: under -march=native it fuses the rotation into
+// vfmaddsub in spite of -ffp-contract=off, and the inlined copies then round differently
+#if defined(__GNUC__) && !defined(__clang__)
+#define SHIPESCAPE_NO_SLP __attribute__((optimize("no-tree-slp-vectorize")))
+#else
+#define SHIPESCAPE_NO_SLP
+#endif
 
 namespace ShipEscape {
-struct V {
-	V(){};
-	V(double X, double Y) : x(X), y(Y) {}
-	double x = 0;
-	double y = 0;
-	void rotate(double angle) {
-		double cs = cos(angle);
-		double sn = sin(angle);
-		double px = x * cs - y * sn;
-		double py = x * sn + y * cs;
+template <typename T> struct BasicV {
+	typedef BasicV V;
+	BasicV(){};
+	BasicV(T X, T Y) : x(X), y(Y) {}
+	T x = 0;
+	T y = 0;
+	SHIPESCAPE_NO_SLP void rotate(T angle) {
+		T cs = cos(angle);
+		T sn = sin(angle);
+		T px = x * cs - y * sn;
+		T py = x * sn + y * cs;
 		x = px;
 		y = py;
 	}
 	void normalize() {
-		double l = sqrt(x * x + y * y);
+		T l = sqrt(x * x + y * y);
 		if (l > 0) {
 			x /= l;
 			y /= l;
 		}
 	}
-	double sqLength() const { return x * x + y * y; }
+	T sqLength() const { return x * x + y * y; }
 	V operator-(const V &v) const { return V(x - v.x, y - v.y); }
 	V operator+(const V &v) const { return V(x + v.x, y + v.y); }
 	V &operator+=(const V &v) {
@@ -48,210 +57,878 @@ struct V {
 		y += v.y;
 		return *this;
 	}
-	double dot(const V &v) const { return x * v.x + y * v.y; }
+	T dot(const V &v) const { return x * v.x + y * v.y; }
+	friend V operator*(const V &v, const T &d) { return V(v.x * d, v.y * d); }
+	friend V operator/(const V &v, const T &d) { return V(v.x / d, v.y / d); }
 };
-V operator*(const V &v, const double &d) { return V(v.x * d, v.y * d); }
-V operator/(const V &v, const double &d) { return V(v.x / d, v.y / d); }
+typedef BasicV<double> V;
 
-struct Ship {
-	double rotationSpeed = 1.0;
+template <typename T> struct BasicShip {
+	typedef BasicV<T> V;
+	T rotationSpeed = 1.0;
 	V dimensions = V(1.3, 2.0);
 	V position;
 	V velocity;
 	V forces;
 	V orientation = V(0, 1);
-	double thrustPower = 2500.0;
+	T thrustPower = 2500.0;
+	// step the steering and thrust constants are tuned for. Other steps give the same motion,
+	// up to integration error: thrust(dt) pushes with the same force, steering blends as
+	// many reference steps would.
+	T referenceDt = 1.0 / 60.0;
 	bool thrusting = false;  // only useful for viewer
-	Ship(){};
-	void rotate(double dir, double dt) {
-		dir = max(dir, -1.0);
-		dir = min(dir, 1.0);
+	// progress along the course, kept by World::update: the last door passed, the next one,
+	// and the time left to reach it
+	T countdown = 6.0;
+	T nextReset = 1;
+	T prevReset = -1000;
+	T coef = 1.0;
+	bool collided = false;
+	BasicShip(){};
+	void rotate(T dir, T dt) {
+		dir = max(dir, T(-1));
+		dir = min(dir, T(1));
 		orientation.rotate(dir * rotationSpeed * dt);
 		orientation.normalize();
 	}
-	double getAngle() { return atan2(orientation.y, orientation.x) - atan2(1.0, 0.0); }
-	void updatePosition(double dt) {
-		double vit = sqrt(velocity.sqLength());
+	T getAngle() const { return atan2(orientation.y, orientation.x) - atan2(1.0, 0.0); }
+	void updatePosition(T dt) {
+		T vit = sqrt(velocity.sqLength());
 		V nV = velocity / vit;
-		double r = max(0.0, nV.dot(orientation));
+		T r = max(T(0), nV.dot(orientation));
 		if (vit > 0) {
-			velocity = orientation * vit * r * CONTROLE + (velocity) * (1.0 - CONTROLE * r);
+			if (dt == referenceDt) {
+				velocity = orientation * vit * r * CONTROLE + (velocity) * (1.0 - CONTROLE * r);
+			} else {
+				T k = 1.0 - pow(1.0 - CONTROLE * r, dt / referenceDt);
+				velocity = orientation * vit * k + velocity * (1 - k);
+			}
 		}
-		velocity = velocity + (forces - velocity * FRICTION) * dt;
+		velocity = velocity + (forces * (referenceDt / dt) - velocity * FRICTION) * dt;
 		position += velocity * dt;
 	}
-	void thrust(double dt) {
-		double actualQ = thrustPower * dt;
+	void thrust(T dt) {
+		T actualQ = thrustPower * dt;
 		forces = forces + orientation * actualQ;
 		thrusting = true;
 	}
 };
+typedef BasicShip<double> Ship;
 
-struct Circle {
-	Circle(const V &c, const double &r) : center(c), radius(r) {}
+template <typename T> struct BasicCircle {
+	typedef BasicV<T> V;
+	BasicCircle(const V &c, const T &r) : center(c), radius(r) {}
 	V center;
-	double radius = 0.2;
+	T radius = 0.2;
+};
+typedef BasicCircle<double> Circle;
+
+// door positions and current aperture, as seen by a ray
+template <typename T> struct BasicDoors {
+	T prevReset;
+	T nextReset;
+	T closedSize;
+};
+typedef BasicDoors<double> Doors;
+
+// how rays look for obstacles: scan every cell of the visibility window, walk the cells
+// along the ray nearest first and stop as soon as no further cell can beat the current hit, or
+// sphere trace the world's distance fields (see BasicWorld::traceField). All give the same
+// distances. traversal is the fastest at the default obstacle density, where distanceField is
+// 3 to 4 times slower per ray and per sensor fan (ray_ and fan_ cases of shipescape_bench).
+// distanceField only wins on crowded courses with long rays: 1500 rays of MAXH at 16 times
+// the default density (light_rays_dense) cast about 1.5 times faster through the fields.
+enum class RayCasting { window, traversal, distanceField };
+
+// how ship collisions are found. discrete, the default: only at the end of the step and
+// against the obstacles of the ship's cell, as older builds did. swept: along the whole move of
+// the step, against every obstacle cell the ship's path comes near and through the door's
+// band, so a large dt can't tunnel through anything. It also catches grazes discrete misses
+// at the default dt, so switching changes results.
+enum class Collisions { swept, discrete };
+
+// how obstacles are drawn. legacy, the default: one default_random_engine seeded with
+// n * n + seedOffset per cell, the courses of older builds (but the seeds of different courses
+// collide, e.g. cell 0 with offset 1000 and cell 31 with offset 39). counter: obstacle i of
+// cell n on the course of seedOffset is the Philox block (n, i) under key seedOffset, so any
+// obstacle can be computed on its own and two courses never share a stream. It draws other
+// courses than legacy: switching changes every result.
+enum class ObstacleRng { counter, legacy };
+
+// The rays a ship senses obstacles with, as fed to shipXP controllers. Ray i leaves at
+// rays[i].angle from the ship's heading, reads at most rays[i].range (0: the world's MAXH)
+// and is cast every rays[i].period controller steps, keeping its last reading in between.
+// The rotation of each ray is computed once by add(), so turning the fan with the ship costs
+// a 2x2 product per ray. The default is the original fan of 11 rays over 1.2 pi.
+struct SensorConfig {
+	static const constexpr int DEFAULT_RAYS = 11;
+	static const constexpr double DEFAULT_SPREAD = M_PI * 1.2;
+	struct Ray {
+		double angle, range;
+		int period;
+		double cs, sn;  // cos and sin of angle
+	};
+	vector<Ray> rays;
+
+	SensorConfig() : SensorConfig(DEFAULT_RAYS, DEFAULT_SPREAD) {}
+	// count rays spread over spread radians, the last one on the left edge of the spread;
+	// SensorConfig(0, 0) has no rays yet
+	SensorConfig(int count, double spread, double range = 0, int period = 1) {
+		for (int i = 0; i < count; ++i)
+			add(-spread / 2.0 + (i + 1) * spread / count, range, period);
+	}
+	void add(double angle, double range = 0, int period = 1) {
+		rays.push_back(Ray{angle, range, max(1, period), cos(angle), sin(angle)});
+	}
+	size_t size() const { return rays.size(); }
+
+	// direction of every ray for a ship orientation
+	template <typename T> void directions(const BasicV<T> &o, BasicV<T> *dirs) const {
+		for (size_t i = 0; i < rays.size(); ++i) {
+			T cs = static_cast<T>(rays[i].cs), sn = static_cast<T>(rays[i].sn);
+			dirs[i] = BasicV<T>(cs * o.x - sn * o.y, sn * o.x + cs * o.y);
+		}
+	}
+	void hash(StableHash &h) const {
+		h.add(static_cast<uint64_t>(rays.size()));
+		for (auto &r : rays) h.add(r.angle).add(r.range).add(r.period);
+	}
+};
+
+// what a ship's sensors read during a run. read() casts the rays due at the current
+// controller step, consecutive ones of the same range as a single fan, and leaves the
+// others' readings as they were.
+template <typename T> struct SensorReadings {
+	vector<BasicV<T>> dirs;
+	vector<T> values;
+	unsigned long steps = 0;  // controller steps read so far
+
+	explicit SensorReadings(const SensorConfig &c) : dirs(c.size()), values(c.size()) {}
+	void reset() {
+		steps = 0;
+		fill(values.begin(), values.end(), T(0));
+	}
+	// cast(dirs, n, maxDist, out) casts n rays from the ship
+	template <typename Cast>
+	void read(const SensorConfig &c, const BasicV<T> &orientation, T maxDist, Cast &&cast) {
+		c.directions(orientation, dirs.data());
+		const size_t n = c.size();
+		for (size_t i = 0; i < n;) {
+			const SensorConfig::Ray &r = c.rays[i];
+			size_t j = i + 1;
+			if (steps % r.period == 0) {
+				while (j < n && steps % c.rays[j].period == 0 && c.rays[j].range == r.range) ++j;
+				T range = r.range > 0 ? min(static_cast<T>(r.range), maxDist) : maxDist;
+				cast(&dirs[i], j - i, range, &values[i]);
+			}
+			i = j;
+		}
+		++steps;
+	}
 };
 
-struct World {
+// The simulation is templated on its scalar type. World (double) is the reference; a
+// BasicWorld<float> halves the footprint of the state and obstacles and doubles the lanes of
+// the ray kernel. Replaying the actions of a double run in a float world keeps the ship
+// within shipXP::FLOAT_POSITION_DRIFT of it and the lasers within FLOAT_RAY_DRIFT (checked
+// by the precision test).
+template <typename T> struct BasicWorld {
+	typedef T Scalar;
+	typedef BasicV<T> V;
+	typedef BasicShip<T> Ship;
+	typedef BasicCircle<T> Circle;
+	typedef BasicDoors<T> Doors;
 	typedef V Vv;
+	typedef ObstacleGrid<Circle> ObstacleMap;
 	vector<Ship> ships;
-	double gridSize = 10.0;
-	unordered_map<int, vector<Circle>> obstacles;
-	double obstacleDensity = 0.005;  // per surface unit
-	double W = 80.0;
-	double MAXH = 1.3 * W;
-	double dt = 1.0 / 60.0;
-	double currentTime = 0;
-	double maxObstaclesRadius = 2.0;
-	double maxCountdown = 6.0;
-	double countdown = maxCountdown;
-	double nextReset = 1;
-	double prevReset = -1000;
-	double step = 20;
-	double coef = 1.0;
-	double coefIncrement = 0.3;
-	bool collided = false;
-	const size_t NBSHIPS = 1;
+	T gridSize = 10.0;
+	ObstacleMap obstacles;
+	T obstacleDensity = 0.005;  // per surface unit
+	T W = 80.0;
+	T MAXH = 1.3 * W;
+	T dt = 1.0 / 60.0;
+	T currentTime = 0;
+	T maxObstaclesRadius = 2.0;
+	T maxCountdown = 6.0;
+	T step = 20;
+	T coefIncrement = 0.3;
 	int seedOffset = 0;
+	RayCasting rayCasting = RayCasting::traversal;
+	ObstacleRng obstacleRng = ObstacleRng::legacy;
+	Collisions collisions = Collisions::discrete;
+	int controlPeriod = 1;  // world steps per controller step in shipXP runs
+	SensorConfig sensors;   // rays of the ships in shipXP runs
+	// distanceField ray casting: spacing of the field samples, and distance to the obstacles
+	// under which a ray stops marching and hits are computed exactly
+	T fieldSpacing = 1.0;
+	T fieldRefine = 1.0;
+	// per cell samples of the distance to the obstacles and walls, and the cell's obstacles
+	// sorted by x, built along with the cells in distanceField mode
+	typedef ObstacleGrid<float> FieldMap;
+	FieldMap fields;
+	ObstacleMap fieldCircles;
 
-	World() {
-		ships.resize(NBSHIPS);
-		ships.at(0).position = V(W / 2.0, 0);
+	BasicWorld() { setShips(1); }
+
+	// Ships fly the course independently: each has its own doors and countdown and finishes
+	// on its own, they don't collide with each other, and they all share the obstacle cells.
+	// A ship flies exactly as it would alone in the world.
+	void setShips(size_t n) {
+		Ship s;
+		s.position = V(W / 2.0, 0);
+		s.countdown = maxCountdown;
+		ships.assign(n, s);
+	}
+	bool finished(const Ship &s) const { return s.collided || s.countdown <= 0; }
+	// every ship finished
+	bool finished() const {
+		for (auto &s : ships)
+			if (!finished(s)) return false;
+		return true;
+	}
+
+	// everything that changes while a world is stepped. The obstacle window is shared with
+	// the world it was taken from until either of them generates new cells.
+	struct State {
+		vector<Ship> ships;
+		T currentTime;
+		int seedOffset;
+		ObstacleMap obstacles;
 	};
-	int getSeed(int n) { return n * n + seedOffset; }
+	State snapshot() const { return State{ships, currentTime, seedOffset, obstacles}; }
+	void restore(const State &st) {
+		ships = st.ships;
+		currentTime = st.currentTime;
+		seedOffset = st.seedOffset;
+		obstacles = st.obstacles;
+	}
+	// the same, copying into storage reused from one call to the next and sharing no cells:
+	// for states taken or shown every frame while the world keeps changing
+	void snapshot(State &st) const {
+		st.ships = ships;
+		st.currentTime = currentTime;
+		st.seedOffset = seedOffset;
+		st.obstacles.copyFrom(obstacles);
+	}
+	void copyFrom(const State &st) {
+		ships = st.ships;
+		currentTime = st.currentTime;
+		seedOffset = st.seedOffset;
+		obstacles.copyFrom(st.obstacles);
+	}
+	// independent copy of the world, sharing the obstacle cells copy-on-write
+	BasicWorld fork() const { return *this; }
+	int getSeed(int n) const { return getSeed(n, seedOffset); }
+	int getSeed(int n, int offset) const { return n * n + offset; }
+
+	T normalizedDistRay(V direction, T maxDist, const Ship &ship) {
+		if (rayCasting == RayCasting::distanceField) {
+			SHIPESCAPE_PROFILE_SCOPE(RAYS);
+			SHIPESCAPE_PROFILE_COUNT(RAYS_CAST, 1);
+			return traceField(ship.position, direction, maxDist, doors(ship), fieldLayout());
+		}
+		return castRay(obstacles, ship.position, direction, maxDist, doors(ship));
+	}
+
+	// doors as seen by a ship
+	Doors doors(const Ship &s) const {
+		T apertureSize = W * s.countdown / maxCountdown;
+		return Doors{s.prevReset, s.nextReset, (W - apertureSize) * T(0.5)};
+	}
 
-	double normalizedDistRay(V direction, double maxDist, const Ship &ship) {
+	// ray cast against an obstacle map and a door state; shared with WorldBatch lanes. Fields
+	// only describe the world's own obstacles, so distanceField mode walks the cells here.
+	T castRay(const ObstacleMap &obs, const V &origin, V direction, T maxDist,
+	               const Doors &d) const {
+		SHIPESCAPE_PROFILE_SCOPE(RAYS);
+		SHIPESCAPE_PROFILE_COUNT(RAYS_CAST, 1);
 		// direction must be normalized !!
-		int gridCell = getGridPosition(ship.position.y);
-		Circle *closest = nullptr;
-		double closestDist = 1e30;
+		if (rayCasting != RayCasting::window) {
+			T closestDist = min(boundsDist(origin, direction, 1e30, d), maxDist);
+			int first, last;
+			int dir = direction.y > 0 ? 1 : (direction.y < 0 ? -1 : 0);
+			walkRange(origin.y, dir, first, last);
+			for (int c = first; c != last + (dir >= 0 ? 1 : -1); c += (dir >= 0 ? 1 : -1)) {
+				if (entryDist(c, origin.y, direction.y) >= closestDist) break;
+				if (auto *cell = obs.find(c)) hitCircles(*cell, origin, direction, closestDist);
+			}
+			return closestDist;
+		}
+		int gridCell = getGridPosition(origin.y);
+		T closestDist = 1e30;
+		int visibility = gridVisibility();
+		for (int shift = -visibility; shift <= visibility; ++shift) {
+			if (auto *cell = obs.find(gridCell + shift))
+				hitCircles(*cell, origin, direction, closestDist);
+		}
+		return min(boundsDist(origin, direction, closestDist, d), maxDist);
+	}
+
+	// lowers closestDist to the nearest hit among the circles, if any is closer
+	void hitCircles(const vector<Circle> &circles, const V &origin, const V &direction,
+	                T &closestDist) const {
+		hitCircles(circles.data(), circles.data() + circles.size(), origin, direction,
+		           closestDist);
+	}
+	void hitCircles(const Circle *begin, const Circle *end, const V &origin, const V &direction,
+	                T &closestDist) const {
+		SHIPESCAPE_PROFILE_COUNT(CIRCLES_TESTED, end - begin);
 		// basis change
 		// direction is Y, Xdir is X
 		V Xdir(-direction.y, direction.x);
+		for (const Circle *c = begin; c != end; ++c) {
+			const Circle &o = *c;
+			// newPos is o.center in direction basis
+			V SE = o.center - origin;
+			V newPos(SE.dot(Xdir), SE.dot(direction));
+			if (newPos.y > 0 && (newPos.x - o.radius) * (newPos.x + o.radius) < 0) {
+				// collision
+				T dist = newPos.y - sqrt((o.radius * o.radius - newPos.x * newPos.x));
+				if (dist > 0 && dist < closestDist) closestDist = dist;
+			}
+		}
+	}
+
+	// cells, nearest first, holding circles that rays going up (dir = 1), down (-1) or
+	// sideways (0) from height y can reach, clipped to the visibility window
+	void walkRange(T y, int dir, int &first, int &last) const {
+		int gridCell = getGridPosition(y);
+		int visibility = gridVisibility();
+		int below = max(gridCell - visibility, getGridPosition(y - maxObstaclesRadius));
+		int above = min(gridCell + visibility, getGridPosition(y + maxObstaclesRadius));
+		if (dir > 0) {
+			first = below;
+			last = gridCell + visibility;
+		} else if (dir < 0) {
+			first = above;
+			last = gridCell - visibility;
+		} else {
+			first = below;
+			last = above;
+		}
+	}
+
+	// lower bound of the distance along a ray at which a circle of the cell can be hit
+	T entryDist(int cell, T y, T dy) const {
+		const T margin = maxObstaclesRadius + 1e-6;
+		if (dy > 0) return (cell * gridSize - margin - y) / dy;
+		if (dy < 0) return ((cell + 1) * gridSize + margin - y) / dy;
+		return 0;
+	}
+
+	// casts n rays from the ship at once, out[i] receives normalizedDistRay(dirs[i], ...)
+	void castFan(const Ship &ship, const V *dirs, size_t n, T maxDist, T *out) const {
+		if (rayCasting == RayCasting::distanceField) {
+			SHIPESCAPE_PROFILE_SCOPE(RAYS);
+			SHIPESCAPE_PROFILE_COUNT(RAYS_CAST, n);
+			const Doors d = doors(ship);
+			const FieldLayout f = fieldLayout();
+			for (size_t i = 0; i < n; ++i)
+				out[i] = traceField(ship.position, dirs[i], maxDist, d, f);
+			return;
+		}
+		castFan(obstacles, ship.position, dirs, n, maxDist, doors(ship), out);
+	}
 
-		int gridVisibility = (MAXH + 1.0) / gridSize;
-		for (int shift = -gridVisibility; shift <= gridVisibility; ++shift) {
-			if (obstacles.count(gridCell + shift)) {
-				for (auto &o : obstacles[gridCell + shift]) {
-					// newPos is o.center in direction basis
-					V SE = o.center - ship.position;
-					V newPos(SE.dot(Xdir), SE.dot(direction));
-					if (newPos.y > 0 && (newPos.x - o.radius) * (newPos.x + o.radius) < 0) {
-						// collision
-						double dist = newPos.y - sqrt((o.radius * o.radius - newPos.x * newPos.x));
-						if (dist > 0 && dist < closestDist) {
-							closestDist = dist;
-							closest = &o;
-						}
-					}
+	// castRay for a whole fan of rays. In window mode obstacles are tested against
+	// RayKernel::lanes(T()) rays at a time, walls and doors are then handled per ray. Traversal
+	// rays stop at their own first hit, after a cell or two, which a block would have to wait
+	// on for its farthest ray: they are cast one by one.
+	void castFan(const ObstacleMap &obs, const V &origin, const V *dirs, size_t n,
+	             T maxDist, const Doors &d, T *out) const {
+		if (rayCasting != RayCasting::window) {
+			for (size_t i = 0; i < n; ++i) out[i] = castRay(obs, origin, dirs[i], maxDist, d);
+			return;
+		}
+		SHIPESCAPE_PROFILE_SCOPE(RAYS);
+		SHIPESCAPE_PROFILE_COUNT(RAYS_CAST, n);
+		const size_t L = RayKernel::lanes(T());
+		int gridCell = getGridPosition(origin.y);
+		int visibility = gridVisibility();
+		for (size_t b = 0; b < n; b += L) {
+			T dx[L], dy[L], closest[L];
+			for (size_t l = 0; l < L; ++l) {
+				size_t i = min(b + l, n - 1);  // last block is padded with copies of the last ray
+				dx[l] = dirs[i].x;
+				dy[l] = dirs[i].y;
+				closest[l] = 1e30;
+			}
+			for (int shift = -visibility; shift <= visibility; ++shift) {
+				if (auto *cell = obs.find(gridCell + shift)) {
+					SHIPESCAPE_PROFILE_COUNT(CIRCLES_TESTED, cell->size() * min(L, n - b));
+					RayKernel::block(cell->data(), cell->size(), origin.x, origin.y, dx, dy,
+					                 closest);
 				}
 			}
+			for (size_t l = 0; l < L && b + l < n; ++l)
+				out[b + l] = min(boundsDist(origin, dirs[b + l], closest[l], d), maxDist);
+		}
+	}
+
+	// Samples of a cell's field: nx by ny points evenly spread over the cell, walls included.
+	// The distance from any point of the cell to its nearest sample is at most half the
+	// diagonal between samples, and distances are 1-Lipschitz, so sample - slack is a lower
+	// bound of the distance at the point (slack also covers rounding to float).
+	struct FieldLayout {
+		int nx, ny;
+		T sx, sy, slack;
+		T invSx, invSy;
+	};
+	FieldLayout fieldLayout() const {
+		FieldLayout f;
+		f.nx = max(2, static_cast<int>(ceil(W / fieldSpacing)) + 1);
+		f.ny = max(2, static_cast<int>(ceil(gridSize / fieldSpacing)) + 1);
+		f.sx = W / (f.nx - 1);
+		f.sy = gridSize / (f.ny - 1);
+		f.slack = T(0.5) * sqrt(f.sx * f.sx + f.sy * f.sy) + T(1e-3);
+		f.invSx = 1 / f.sx;
+		f.invSy = 1 / f.sy;
+		return f;
+	}
+
+	// Ray cast by sphere tracing the fields: the ray leaps over the space the field proves
+	// empty, and wherever it comes within fieldRefine of an obstacle (or finds no field) the
+	// circles it can hit over the next fieldReach are tested exactly, from the origin, before
+	// moving on. Returns exactly what castRay does in the other modes.
+	T traceField(const V &origin, const V &direction, T maxDist, const Doors &d,
+	             const FieldLayout &f) const {
+		T closestDist = min(boundsDist(origin, direction, 1e30, d), maxDist);
+		int gridCell = getGridPosition(origin.y);
+		int visibility = gridVisibility();
+		const T reach = fieldReach(f);
+		const T margin = maxObstaclesRadius + reach;
+		FieldCursor cur;
+		T t = 0;
+		while (t < closestDist) {
+			V p = origin + direction * t;
+			T free = fieldDist(p, f, cur);
+			if (free >= fieldRefine) {
+				t += free;
+				continue;
+			}
+			// a circle hit within reach of p has its center within margin of p on both axes
+			int first = max(gridCell - visibility, getGridPosition(p.y - margin));
+			int last = min(gridCell + visibility, getGridPosition(p.y + margin));
+			for (int c = first; c <= last; ++c) {
+				auto *cell = obstacles.find(c);
+				if (!cell) continue;
+				auto *sorted = fieldCircles.find(c);
+				if (!sorted) {
+					hitCircles(*cell, origin, direction, closestDist);
+					continue;
+				}
+				const Circle *all = sorted->data(), *end = all + sorted->size();
+				const Circle *b = lower_bound(all, end, p.x - margin,
+				                              [](const Circle &o, T x) { return o.center.x < x; });
+				const Circle *e = upper_bound(b, end, p.x + margin,
+				                              [](T x, const Circle &o) { return x < o.center.x; });
+				hitCircles(b, e, origin, direction, closestDist);
+			}
+			t += reach;
+		}
+		return closestDist;
+	}
+
+	// length of ray checked exactly at once: enough to get past the region where the field
+	// is too coarse to prove anything
+	T fieldReach(const FieldLayout &f) const { return 2 * (fieldRefine + f.slack); }
+
+	// field of the cell a ray is in, looked up again only when the ray changes cells
+	struct FieldCursor {
+		int cell = ObstacleMap::EMPTY;
+		const vector<float> *field = nullptr;
+	};
+	// lower bound of the distance from p to the obstacles, negative if unknown
+	T fieldDist(const V &p, const FieldLayout &f, FieldCursor &cur) const {
+		if (!(p.x >= 0 && p.x <= W)) return -1;
+		int c = getGridPosition(p.y);
+		if (c != cur.cell) {
+			cur.cell = c;
+			cur.field = fields.find(c);
 		}
+		if (!cur.field || cur.field->empty()) return -1;
+		int i = min(f.nx - 1, static_cast<int>(p.x * f.invSx + T(0.5)));
+		int j = min(f.ny - 1, max(0, static_cast<int>((p.y - c * gridSize) * f.invSy + T(0.5))));
+		return (*cur.field)[j * f.nx + i] - f.slack;
+	}
+
+	// builds the missing fields of the cells visible from heights low to high. A cell's field
+	// needs the obstacles of the cells around it, so it waits for the cell above to be
+	// generated; the one below is drawn again if it was dropped behind the doors.
+	void fillFields(T low, T high) {
+		SHIPESCAPE_PROFILE_SCOPE(OBSTACLES);
+		if (fieldSeed != seedOffset || fieldRng != obstacleRng) {
+			fields.clear();
+			fieldCircles.clear();
+			fieldSeed = seedOffset;
+			fieldRng = obstacleRng;
+		}
+		const FieldLayout f = fieldLayout();
+		if (fields.capacity() != obstacles.capacity()) {
+			fields.setCapacity(obstacles.capacity(), f.nx * f.ny);
+			fieldCircles.setCapacity(obstacles.capacity(), nbObstaclesPerCell());
+		}
+		int visibility = gridVisibility();
+		for (int c = getGridPosition(low) - visibility; c <= getGridPosition(high) + visibility;
+		     ++c) {
+			if (fields.count(c) || !obstacles.count(c) || !obstacles.count(c + 1)) continue;
+			const vector<Circle> *below = obstacles.find(c - 1);
+			if (!below) {
+				fieldScratch.clear();
+				if (c > 0) generateCell(c - 1, seedOffset, fieldScratch);
+				below = &fieldScratch;
+			}
+			const vector<Circle> *around[3] = {below, obstacles.find(c), obstacles.find(c + 1)};
+			buildField(c, around, f, fields.insert(c));
+			vector<Circle> &sorted = fieldCircles.insert(c);
+			sorted = *around[1];
+			sort(sorted.begin(), sorted.end(),
+			     [](const Circle &a, const Circle &b) { return a.center.x < b.center.x; });
+		}
+	}
+
+	// samples of the distance to the walls and the circles of a cell and its neighbours. Any
+	// other circle is at least gridSize - maxObstaclesRadius away from the cell.
+	void buildField(int cell, const vector<Circle> *const around[3], const FieldLayout &f,
+	                vector<float> &out) const {
+		out.resize(f.nx * f.ny);
+		for (int j = 0; j < f.ny; ++j) {
+			for (int i = 0; i < f.nx; ++i) {
+				V s(i * f.sx, cell * gridSize + j * f.sy);
+				T dist = min(min(s.x, W - s.x), gridSize - maxObstaclesRadius);
+				for (int k = 0; k < 3; ++k) {
+					for (auto &o : *around[k])
+						dist = min(dist, sqrt((s - o.center).sqLength()) - o.radius);
+				}
+				out[j * f.nx + i] = static_cast<float>(dist);
+			}
+		}
+	}
+
+	// closest of closestDist and the lateral walls / doors along a ray
+	T boundsDist(const V &origin, const V &direction, T closestDist,
+	                  const Doors &d) const {
 		// lateral Walls
 		if (direction.x != 0) {
 			if (direction.x < 0) {
 				// wall 0
-				double Yintersect =
-				    ship.position.y + direction.y * (-ship.position.x) / direction.x;
-				double dist = (V(0, Yintersect) - ship.position).sqLength();
+				T Yintersect = origin.y + direction.y * (-origin.x) / direction.x;
+				T dist = (V(0, Yintersect) - origin).sqLength();
 				if (dist < closestDist * closestDist) closestDist = sqrt(dist);
 			} else {
 				// wall 1
-				double Yintersect =
-				    ship.position.y + direction.y * (W - ship.position.x) / direction.x;
-				double dist = (V(W, Yintersect) - ship.position).sqLength();
+				T Yintersect = origin.y + direction.y * (W - origin.x) / direction.x;
+				T dist = (V(W, Yintersect) - origin).sqLength();
 				if (dist < closestDist * closestDist) closestDist = sqrt(dist);
 			}
 		}
 		// doors
-		double apertureSize = W * countdown / maxCountdown;
-		double closedSize = (W - apertureSize) * 0.5;
 		if (direction.y != 0) {
 			if (direction.y < 0) {
 				// prevReset
-				double Xintersect =
-				    ship.position.x + direction.x * (prevReset - ship.position.y) / direction.y;
-				double dist = (V(Xintersect, prevReset) - ship.position).sqLength();
+				T Xintersect =
+				    origin.x + direction.x * (d.prevReset - origin.y) / direction.y;
+				T dist = (V(Xintersect, d.prevReset) - origin).sqLength();
 				if (dist < closestDist * closestDist) closestDist = sqrt(dist);
 			} else {
 				// nextReset
-				double Xintersect =
-				    ship.position.x + direction.x * (nextReset - ship.position.y) / direction.y;
-				if (Xintersect < closedSize || Xintersect > W - closedSize) {
-					double dist = (V(Xintersect, nextReset) - ship.position).sqLength();
+				T Xintersect =
+				    origin.x + direction.x * (d.nextReset - origin.y) / direction.y;
+				if (Xintersect < d.closedSize || Xintersect > W - d.closedSize) {
+					T dist = (V(Xintersect, d.nextReset) - origin).sqLength();
 					if (dist < closestDist * closestDist) closestDist = sqrt(dist);
 				}
 			}
 		}
-		return min(closestDist, maxDist);
+		return closestDist;
 	}
 
+	// generates the obstacle window of the ships still flying (of all ships if none is)
 	void updateObstacles() {
-		uniform_real_distribution<double> dist(0.0, 1.0);
-		int gridVisibility = (MAXH + 1.0) / gridSize;
-		int nbObstacles = static_cast<int>(obstacleDensity * gridSize * W);
+		bool any = false;
+		for (auto &s : ships) any = any || !finished(s);
+		T low = numeric_limits<T>::max(), high = numeric_limits<T>::lowest(), door = low;
+		for (auto &s : ships) {
+			if (any && finished(s)) continue;
+			low = min(low, s.position.y);
+			high = max(high, s.position.y);
+			door = min(door, s.prevReset);
+		}
+		fillObstacles(obstacles, low, high, seedOffset, door);
+		if (rayCasting == RayCasting::distanceField) fillFields(low, high);
+	}
+
+	int gridVisibility() const { return (MAXH + 1.0) / gridSize; }
+
+	void fillObstacles(ObstacleMap &obs, T y, int offset, T closedDoor) const {
+		fillObstacles(obs, y, y, offset, closedDoor);
+	}
+	// makes sure every cell visible from heights low to high is generated. Cells lying
+	// entirely behind the closed door (radius margin included) can't be reached by any ray and
+	// are skipped, which lets the window slide forward. Grows the grid to hold the whole span.
+	void fillObstacles(ObstacleMap &obs, T low, T high, int offset, T closedDoor) const {
+		SHIPESCAPE_PROFILE_SCOPE(OBSTACLES);
+		int visibility = gridVisibility();
+		int lowCell = getGridPosition(low), highCell = getGridPosition(high);
+		size_t windowSize = highCell - lowCell + 2 * visibility + 1;
+		if (obs.capacity() < windowSize)
+			obs.setCapacity(max(windowSize, 2 * obs.capacity()), nbObstaclesPerCell());
 		// we need to generate all visible obstacles;
-		int currentGridCell = static_cast<int>(floor(ships.at(0).position.y / gridSize));
-		for (int visibleCell = currentGridCell - gridVisibility;
-		     visibleCell <= currentGridCell + gridVisibility; ++visibleCell) {
-			if (visibleCell >= 0 && !obstacles.count(visibleCell)) {
+		for (int visibleCell = lowCell - visibility; visibleCell <= highCell + visibility;
+		     ++visibleCell) {
+			if (visibleCell < 0 || (visibleCell + 1) * gridSize + maxObstaclesRadius < closedDoor) {
+				obs.erase(visibleCell);
+			} else if (!obs.count(visibleCell)) {
 				// a potentially visible grid cell is empty, we need to fill it;
-				default_random_engine generator(getSeed(visibleCell));
-				V bottomLeftCorner = V(0, 0) + V(0, 1) * visibleCell * gridSize;
-				for (int i = 0; i < nbObstacles; ++i) {
-					obstacles[visibleCell].push_back(Circle(
-					    V(dist(generator) * W, dist(generator) * gridSize) + bottomLeftCorner,
-					    max(0.3, dist(generator)) * maxObstaclesRadius));
-				}
+				generateCell(visibleCell, offset, obs.insert(visibleCell));
+			}
+		}
+	}
+
+	// the margin keeps float parameters (0.005f * 10 * 80 is just below 4) on the same count
+	int nbObstaclesPerCell() const {
+		return static_cast<int>(double(obstacleDensity) * gridSize * W * (1.0 + 1e-6));
+	}
+
+	// obstacles are drawn in double precision whatever T is, then rounded
+	void generateCell(int cell, int offset, vector<Circle> &out) const {
+		SHIPESCAPE_PROFILE_COUNT(CELLS_GENERATED, 1);
+		int nbObstacles = nbObstaclesPerCell();
+		out.reserve(nbObstacles);
+		if (obstacleRng == ObstacleRng::legacy) {
+			uniform_real_distribution<double> dist(0.0, 1.0);
+			default_random_engine generator(getSeed(cell, offset));
+			V bottomLeftCorner = V(0, 0) + V(0, 1) * cell * gridSize;
+			for (int i = 0; i < nbObstacles; ++i) {
+				out.push_back(
+				    Circle(V(dist(generator) * W, dist(generator) * gridSize) + bottomLeftCorner,
+				           max(0.3, dist(generator)) * maxObstaclesRadius));
 			}
+			return;
 		}
+		// whole chunks of obstacles at once
+		const int CHUNK = 16;
+		uint32_t u[4][CHUNK];
+		uint32_t *const words[4] = {u[0], u[1], u[2], u[3]};
+		for (int first = 0; first < nbObstacles; first += CHUNK) {
+			int n = min(CHUNK, nbObstacles - first);
+			Philox::blocks(static_cast<uint32_t>(offset), 0, static_cast<uint32_t>(cell),
+			               static_cast<uint32_t>(first), n, words);
+			for (int i = 0; i < n; ++i) out.push_back(obstacle(cell, u[0][i], u[1][i], u[2][i]));
+		}
+	}
+
+	// obstacle i of cell n on the course of seedOffset offset, without generating the cell.
+	// O(1) with the counter generator; legacy courses have to draw the cell up to it.
+	Circle obstacleAt(int cell, int i, int offset) const {
+		if (obstacleRng == ObstacleRng::legacy) {
+			vector<Circle> c;
+			generateCell(cell, offset, c);
+			return c.at(i);
+		}
+		uint32_t u[4];
+		Philox::block(static_cast<uint32_t>(offset), 0, static_cast<uint32_t>(cell),
+		              static_cast<uint32_t>(i), 0, 0, u);
+		return obstacle(cell, u[0], u[1], u[2]);
+	}
+
+	// obstacle of cell n from three random words: position in the cell, then radius
+	Circle obstacle(int cell, uint32_t ux, uint32_t uy, uint32_t ur) const {
+		return Circle(V(Philox::uniform(ux) * W, (cell + Philox::uniform(uy)) * gridSize),
+		              max(0.3, Philox::uniform(ur)) * maxObstaclesRadius);
+	}
+
+	// whether a ship moving from `from` to `to` during a step ran into a wall, a door or an
+	// obstacle. approached: the doors it was heading for during the step, d: its doors at the
+	// end of it (they differ when the step passed a door). Shared with WorldBatch lanes.
+	bool collides(const ObstacleMap &obs, const V &from, const V &to, const Doors &approached,
+	              const Doors &d) const {
+		if (to.x < 0 || to.x > W || to.y < d.prevReset) return true;
+		if (collisions == Collisions::discrete)
+			return crossesDoor(to, to, d) || collidesObstacles(obs, to);
+		return crossesDoor(from, to, approached) ||
+		       (d.nextReset != approached.nextReset && crossesDoor(from, to, d)) ||
+		       sweptObstacles(obs, from, to);
+	}
+
+	// whether the segment from a to b goes through the closed part of the next door, within
+	// half a unit of it
+	bool crossesDoor(const V &a, const V &b, const Doors &d) const {
+		T low = d.nextReset - 0.5, high = d.nextReset + 0.5;
+		T t0 = 0, t1 = 1;
+		if (a.y == b.y) {
+			if (!(a.y < high && a.y > low)) return false;
+		} else {
+			// part of the segment inside the band
+			T ta = (low - a.y) / (b.y - a.y), tb = (high - a.y) / (b.y - a.y);
+			t0 = max(t0, min(ta, tb));
+			t1 = min(t1, max(ta, tb));
+			if (t0 > t1 || (t0 == t1 && (t0 == ta || t0 == tb))) return false;
+		}
+		T x0 = a.x + (b.x - a.x) * t0, x1 = a.x + (b.x - a.x) * t1;
+		return min(x0, x1) < d.closedSize || max(x0, x1) > W - d.closedSize;
 	}
+
+	// whether the ship comes within collision distance of an obstacle anywhere on the
+	// segment from a to b, in any cell
+	bool sweptObstacles(const ObstacleMap &obs, const V &a, const V &b) const {
+		const T margin = maxObstaclesRadius + 0.7;
+		V ab = b - a;
+		T len2 = ab.sqLength();
+		int first = getGridPosition(min(a.y, b.y) - margin);
+		int last = getGridPosition(max(a.y, b.y) + margin);
+		for (int c = first; c <= last; ++c) {
+			auto *cell = obs.find(c);
+			if (!cell) continue;
+			for (auto &o : *cell) {
+				// closest point of the segment to the center
+				T t = len2 > 0 ? min(max((o.center - a).dot(ab) / len2, T(0)), T(1)) : T(0);
+				V p = a + ab * t;
+				if ((p - o.center).sqLength() < pow(o.radius + 0.7, 2)) return true;
+			}
+		}
+		return false;
+	}
+
+	bool collidesObstacles(const ObstacleMap &obs, const V &p) const {
+		if (auto *cell = obs.find(getGridPosition(p.y))) {
+			for (auto &o : *cell)
+				if ((p - o.center).sqLength() < pow(o.radius + 0.7, 2)) return true;
+		}
+		return false;
+	}
+
 	void update() {
 		currentTime += dt;
-		countdown -= dt;
-		V prevPos = ships.at(0).position;
-		for (auto &s : ships) {
-			s.updatePosition(dt);
-		}
-		if (ships.at(0).position.y >= nextReset + ships.at(0).dimensions.y * 0.5) {
-			prevReset = nextReset;
-			nextReset += step * coef;
-			coef += coefIncrement;
-			countdown = maxCountdown;
-		}
-		updateObstacles();
-		int gridPosition = getGridPosition(ships.at(0).position.y);
-		if (ships.at(0).position.x < 0 || ships.at(0).position.x > W) collided = true;
-		double apertureSize = W * countdown / maxCountdown;
-		double closedSize = (W - apertureSize) * 0.5;
-		if (ships.at(0).position.y < prevReset) collided = true;
-		if (ships.at(0).position.y < nextReset + 0.5 &&
-		    ships.at(0).position.y > nextReset - 0.5) {
-			if (ships.at(0).position.x < closedSize || ships.at(0).position.x > W - closedSize)
-				collided = true;
-		}
-		if (obstacles.count(gridPosition)) {
-			for (auto &o : obstacles.at(gridPosition)) {
-				if ((ships.at(0).position - o.center).sqLength() < pow(o.radius + 0.7, 2)) {
-					collided = true;
+		stepping.resize(ships.size());
+		T low = numeric_limits<T>::max(), high = numeric_limits<T>::lowest(), door = low;
+		{
+			SHIPESCAPE_PROFILE_SCOPE(PHYSICS);
+			for (size_t i = 0; i < ships.size(); ++i) {
+				Ship &s = ships[i];
+				stepping[i].active = !finished(s);
+				if (!stepping[i].active) continue;
+				stepping[i].from = s.position;
+				s.countdown -= dt;
+				s.updatePosition(dt);
+				stepping[i].approached = doors(s);
+				if (s.position.y >= s.nextReset + s.dimensions.y * 0.5) {
+					s.prevReset = s.nextReset;
+					s.nextReset += step * s.coef;
+					s.coef += coefIncrement;
+					s.countdown = maxCountdown;
 				}
+				low = min(low, s.position.y);
+				high = max(high, s.position.y);
+				door = min(door, s.prevReset);
 			}
 		}
-		ships.at(0).forces = V(0, 0);
+		if (low <= high) {
+			fillObstacles(obstacles, low, high, seedOffset, door);
+			if (rayCasting == RayCasting::distanceField) fillFields(low, high);
+		}
+		SHIPESCAPE_PROFILE_COUNT(OBSTACLE_CELLS, obstacles.size());
+		SHIPESCAPE_PROFILE_SCOPE(COLLISIONS);
+		for (size_t i = 0; i < ships.size(); ++i) {
+			if (!stepping[i].active) continue;
+			Ship &s = ships[i];
+			if (collides(obstacles, stepping[i].from, s.position, stepping[i].approached, doors(s)))
+				s.collided = true;
+			s.forces = V(0, 0);
+		}
 	}
 
-	int getGridPosition(double y) { return static_cast<int>(floor(y / gridSize)); }
+	int getGridPosition(T y) const { return static_cast<int>(floor(y / gridSize)); }
+
+ private:
+	// ships moved by the current update, where they started from and the doors they approached
+	struct Move {
+		bool active;
+		V from;
+		Doors approached;
+	};
+	vector<Move> stepping;
+	// course the fields were built for, and room to draw a dropped neighbour cell
+	int fieldSeed = 0;
+	ObstacleRng fieldRng = ObstacleRng::legacy;
+	vector<Circle> fieldScratch;
+};
+typedef BasicWorld<double> World;
+}
+
+// the window draws a World (and its light), so it can only come once World is complete
+#ifdef DISPLAY
+#include <QtCore/qmath.h>
+#include <QtGui/QGuiApplication>
+#include <QtGui/QMatrix4x4>
+#include <QtGui/QOpenGLShaderProgram>
+#include <QtGui/QScreen>
+#include "visibility.hpp"
+#include "viewer/shipwindow.hpp"
+#endif
+
+namespace ShipEscape {
+// How shipXP talks to a controller: names are resolved to handles once, then every step only
+// goes through set / get. The default handle is the protein name itself, built once and
+// passed by reference, so stepping never allocates. Genomes exposing index based accessors
+// can specialize this to use integer handles and skip the name lookups.
+template <typename G> struct ControllerIO {
+	typedef std::string Handle;
+	static Handle input(const G &, const std::string &name) { return name; }
+	static Handle output(const G &, const std::string &name) { return name; }
+	static void set(G &g, const Handle &h, double c) { g.setInputConcentration(h, c); }
+	static double get(G &g, const Handle &h) { return g.getOutputConcentration(h); }
 };
 
 struct shipXP {
-	static const constexpr int NBLASERS = 11;
-	template <typename G> static G randomInit(size_t nbReguls = 1) {
+	// default sensor fan (see SensorConfig)
+	static const constexpr int NBLASERS = SensorConfig::DEFAULT_RAYS;
+	static const constexpr double TURNSPEED = 8.0;
+	static const constexpr double TETA = SensorConfig::DEFAULT_SPREAD;
+
+	// what the controller asks for during one step
+	struct Actions {
+		bool left = false;
+		bool right = false;
+		bool thrust = false;
+	};
+
+	// sensors and actuators of a controller, resolved once per individual. Ray i of the
+	// sensors is input "i".
+	template <typename G> struct Handles {
+		typedef ControllerIO<G> IO;
+		typename IO::Handle c, s, l0, l1, r0, r1, t0, t1;
+		vector<typename IO::Handle> lasers;
+		explicit Handles(const G &g, size_t nbLasers = NBLASERS)
+		    : c(IO::input(g, "c")),
+		      s(IO::input(g, "s")),
+		      l0(IO::output(g, "l0")),
+		      l1(IO::output(g, "l1")),
+		      r0(IO::output(g, "r0")),
+		      r1(IO::output(g, "r1")),
+		      t0(IO::output(g, "t0")),
+		      t1(IO::output(g, "t1")) {
+			for (size_t i = 0; i < nbLasers; ++i) lasers.push_back(IO::input(g, std::to_string(i)));
+		}
+	};
+
+	// a run observer is called after every world update, and its begin(world) member, if it
+	// has one, before the first step; the default observer does nothing
+	struct NoObserver {
+		template <typename... A> void operator()(A &&...) {}
+	};
+	template <typename O, typename Wd>
+	static auto beginRun(O &observer, const Wd &world, int) -> decltype(observer.begin(world)) {
+		return observer.begin(world);
+	}
+	template <typename O, typename Wd> static void beginRun(O &, const Wd &, long) {}
+	template <typename G>
+	static G randomInit(size_t nbReguls = 1, const SensorConfig &sensors = SensorConfig()) {
 		G g;
 		g.randomParams();
 		g.addRandomProtein(G::ProteinType_t::input, "c");  // cos angle
 		g.addRandomProtein(G::ProteinType_t::input, "s");  // sin angle
-		for (int i = 0; i < NBLASERS; ++i)
+		for (size_t i = 0; i < sensors.size(); ++i)
 			g.addRandomProtein(G::ProteinType_t::input, std::to_string(i));
 
 		// turn left
@@ -267,65 +944,400 @@ struct shipXP {
 		return g;
 	}
 
-	template <typename I> static void evaluate(I &ind, bool dbg = false) {
-		const int NRUN = 2;
-		const double TURNSPEED = 8.0;
-		const double TETA = M_PI * 1.2;
-		auto &g = ind.dna;
-		double d = 0;
-		for (int r = 0; r < NRUN; ++r) {
+	static const constexpr int NRUN = 2;
+	// float world against double world over the reference runs (see BasicWorld)
+	static const constexpr double FLOAT_POSITION_DRIFT = 1e-3;
+	static const constexpr double FLOAT_RAY_DRIFT = 1e-2;
+
+	// Optional early termination of evaluations. A run is cut once the ship's height hasn't
+	// improved for stallTime simulated seconds, and an individual's remaining runs are skipped
+	// as soon as scoring maxRunFitness on each of them couldn't bring its mean up to
+	// targetFitness. The default budget never stops anything.
+	struct EvalBudget {
+		double targetFitness = -numeric_limits<double>::infinity();
+		double maxRunFitness = numeric_limits<double>::infinity();
+		double stallTime = 0;  // 0 disables stall detection
+		bool hasTarget() const { return targetFitness > -numeric_limits<double>::infinity(); }
+	};
+
+	// partial is set when the evaluation was cut short: skipped runs then count as 0 and cut
+	// runs as the height reached when they were stopped, so fitness is a lower bound
+	struct EvalResult {
+		double fitness = 0;
+		bool partial = false;
+		int runs = 0;  // runs actually simulated, cut ones included
+	};
+
+	// each run gets its own copy of the controller, so runs are independent of each other
+	// and of the order (or thread) they are evaluated in
+	template <typename I> static void evaluate(I &ind, bool = false) {
+		evaluate(ind, EvalBudget());
+	}
+	template <typename I> static EvalResult evaluate(I &ind, const EvalBudget &budget) {
+		EvalResult res = evaluateRuns(ind.dna, budget);
+		ind.fitnesses["distance"] = res.fitness;
+
 #ifdef DISPLAY
-			QSurfaceFormat f;
-			f.setSamples(8);
-			QGuiApplication app(argc, argv);
-			ShipWindow<World> window(world, stepFunc);
+		std::cerr << "Fitness = " << ind.fitnesses["distance"] << std::endl;
 #endif
+		return res;
+	}
+	// evaluate through a cache: a genome evaluated before (with the same settings) gets the
+	// stored result instead of flying its runs again
+	template <typename I>
+	static EvalResult evaluate(I &ind, const EvalBudget &budget, FitnessCache &cache) {
+		uint64_t key = evaluationKey(ind.dna, budget);
+		FitnessCache::Entry e;
+		EvalResult res;
+		if (cache.find(key, e)) {
+			res = fromEntry(e);
+		} else {
+			res = evaluateRuns(ind.dna, budget);
+			cache.insert(key, toEntry(res));
+		}
+		ind.fitnesses["distance"] = res.fitness;
+		return res;
+	}
+
+	// Bumped whenever a change of the simulation changes fitnesses, which invalidates the
+	// results of saved fitness caches
+	static const constexpr uint32_t FITNESS_VERSION = 1;
+
+	// fitness cache key of a genome: its GenomeHash, and everything else the result of
+	// evaluating it depends on, i.e. the world of its runs, the scalar type and the budget
+	template <typename T = double, typename G>
+	static uint64_t evaluationKey(const G &dna, const EvalBudget &budget) {
+		const BasicWorld<T> w;
+		const BasicShip<T> &s = w.ships.at(0);
+		StableHash h;
+		h.add(GenomeHash<G>::hash(dna)).add(static_cast<uint32_t>(FITNESS_VERSION));
+		h.add(static_cast<uint32_t>(sizeof(T))).add(static_cast<int>(NRUN));
+		h.add(double(TURNSPEED));
+		w.sensors.hash(h);
+		for (T v : {w.gridSize, w.obstacleDensity, w.W, w.MAXH, w.dt, w.maxObstaclesRadius,
+		            w.maxCountdown, w.step, w.coefIncrement, s.rotationSpeed, s.thrustPower})
+			h.add(v);
+		h.add(w.obstacleRng).add(w.collisions).add(w.controlPeriod);
+		h.add(budget.targetFitness).add(budget.maxRunFitness).add(budget.stallTime);
+		return h.value();
+	}
+
+	template <typename G>
+	static EvalResult evaluateRuns(const G &dna, const EvalBudget &budget = EvalBudget()) {
+		return evaluateRuns(dna, budget, NRUN, [](World &w, int r) { w.seedOffset = r * 1000; });
+	}
+	// same, over nbRuns runs on the worlds setup(world, r) prepares for run r (e.g. from a
+	// RemoteConfig), each watched by the observer observerOf(r) returns
+	template <typename G, typename S>
+	static EvalResult evaluateRuns(const G &dna, const EvalBudget &budget, int nbRuns, S &&setup) {
+		return evaluateRuns(dna, budget, nbRuns, setup, [](int) { return NoObserver(); });
+	}
+	template <typename G, typename S, typename F>
+	static EvalResult evaluateRuns(const G &dna, const EvalBudget &budget, int nbRuns, S &&setup,
+	                               F &&observerOf) {
+		EvalResult res;
+		double d = 0;
+		for (int r = 0; r < nbRuns; ++r) {
+			if ((d + (nbRuns - r) * budget.maxRunFitness) / nbRuns < budget.targetFitness) {
+				res.partial = true;
+				break;
+			}
+			G g = dna;
 			World world;
+			setup(world, r);
+			bool stalled = false;
+			d += run(g, world, observerOf(r), budget.stallTime, &stalled);
+			res.partial = res.partial || stalled;
+			++res.runs;
+		}
+		res.fitness = nbRuns > 0 ? d / static_cast<double>(nbRuns) : 0.0;
+		return res;
+	}
+
+	// evaluates every individual of [begin, end) (random access iterators) on the pool.
+	// Without a target fitness the (individual, run) pairs are spread independently,
+	// otherwise each individual's runs go in order so that hopeless ones can be cut.
+	// Fitnesses don't depend on the number of threads.
+	template <typename It>
+	static vector<EvalResult> evaluatePopulation(It begin, It end, ThreadPool &pool,
+	                                             const EvalBudget &budget = EvalBudget()) {
+		typedef typename std::decay<decltype(begin->dna)>::type G;
+		size_t n = static_cast<size_t>(end - begin);
+		vector<const G *> dnas(n);
+		for (size_t i = 0; i < n; ++i) dnas[i] = &begin[i].dna;
+		vector<EvalResult> results = evaluateGenomes(dnas, pool, budget);
+		for (size_t i = 0; i < n; ++i) begin[i].fitnesses["distance"] = results[i].fitness;
+		return results;
+	}
+	// evaluatePopulation through a cache: only the genomes that are neither in the cache nor
+	// clones of one evaluated earlier in the population are flown, the others get the result
+	// of their original. Results are the same as without the cache.
+	template <typename It>
+	static vector<EvalResult> evaluatePopulation(It begin, It end, ThreadPool &pool,
+	                                             FitnessCache &cache,
+	                                             const EvalBudget &budget = EvalBudget()) {
+		typedef typename std::decay<decltype(begin->dna)>::type G;
+		size_t n = static_cast<size_t>(end - begin);
+		vector<EvalResult> results(n);
+		vector<uint64_t> keys(n);
+		vector<const G *> dnas;
+		vector<size_t> source(n, n);  // index in dnas of the evaluation of i, n if cached
+		unordered_map<uint64_t, size_t> pending;
+		for (size_t i = 0; i < n; ++i) {
+			keys[i] = evaluationKey(begin[i].dna, budget);
+			FitnessCache::Entry e;
+			auto p = pending.find(keys[i]);
+			if (p != pending.end()) {
+				source[i] = p->second;
+			} else if (cache.find(keys[i], e)) {
+				results[i] = fromEntry(e);
+			} else {
+				source[i] = dnas.size();
+				pending[keys[i]] = dnas.size();
+				dnas.push_back(&begin[i].dna);
+			}
+		}
+		vector<EvalResult> evaluated = evaluateGenomes(dnas, pool, budget);
+		for (size_t i = 0; i < n; ++i) {
+			if (source[i] < n) {
+				results[i] = evaluated[source[i]];
+				cache.insert(keys[i], toEntry(results[i]));
+			}
+			begin[i].fitnesses["distance"] = results[i].fitness;
+		}
+		return results;
+	}
+	// evaluatePopulation's work, on genomes
+	template <typename G>
+	static vector<EvalResult> evaluateGenomes(const vector<const G *> &dnas, ThreadPool &pool,
+	                                          const EvalBudget &budget) {
+		size_t n = dnas.size();
+		vector<EvalResult> results(n);
+		if (budget.hasTarget()) {
+			pool.run(n, [&](size_t i) { results[i] = evaluateRuns(*dnas[i], budget); });
+			return results;
+		}
+		vector<double> dist(n * NRUN);
+		vector<uint8_t> stalled(n * NRUN);
+		pool.run(n * NRUN, [&](size_t t) {
+			int r = static_cast<int>(t % NRUN);
+			bool st = false;
+			dist[t] = evaluateRun(*dnas[t / NRUN], r, NoObserver(), budget.stallTime, &st);
+			stalled[t] = st;
+		});
+		for (size_t i = 0; i < n; ++i) {
+			double d = 0;
+			for (int r = 0; r < NRUN; ++r) {
+				d += dist[i * NRUN + r];
+				results[i].partial = results[i].partial || stalled[i * NRUN + r];
+			}
+			results[i].fitness = d / static_cast<double>(NRUN);
+			results[i].runs = NRUN;
+		}
+		return results;
+	}
+	static FitnessCache::Entry toEntry(const EvalResult &r) {
+		FitnessCache::Entry e;
+		e.fitness = r.fitness;
+		e.runs = r.runs;
+		e.partial = r.partial;
+		return e;
+	}
+	static EvalResult fromEntry(const FitnessCache::Entry &e) {
+		EvalResult r;
+		r.fitness = e.fitness;
+		r.runs = e.runs;
+		r.partial = e.partial != 0;
+		return r;
+	}
+
+	// evaluatePopulation with the individuals flying together: each task flies a group of
+	// them as the ships of a single world (see runShared), so the groups share world setup
+	// and obstacle generation. Fitnesses are the same as evaluatePopulation's, and don't
+	// depend on the number of threads either.
+	template <typename T = double, typename It>
+	static vector<EvalResult> evaluateShared(It begin, It end, ThreadPool &pool) {
+		typedef typename std::decay<decltype(begin->dna)>::type G;
+		size_t n = static_cast<size_t>(end - begin);
+		size_t groups = max<size_t>(1, min(n, pool.size()));
+		vector<double> dist(n * NRUN);
+		pool.run(groups * NRUN, [&](size_t t) {
+			size_t first = t / NRUN * n / groups, last = (t / NRUN + 1) * n / groups;
+			int r = static_cast<int>(t % NRUN);
+			vector<G> gs;
+			gs.reserve(last - first);
+			for (size_t i = first; i < last; ++i) gs.push_back(begin[i].dna);
+			vector<double> heights(gs.size());
+			BasicWorld<T> world;
 			world.seedOffset = r * 1000;
-			const double maxDist = world.MAXH;
-			auto &s = world.ships.at(0);
-			bool finished = false;
-			auto stepFunc = [&]() {
-				auto dir = s.orientation;
-				g.setInputConcentration("c", dir.x * 0.5 + 0.5);
-				g.setInputConcentration("s", dir.y * 0.5 + 0.5);
-				dir.rotate(-TETA / 2.0);
-				for (int i = 0; i < NBLASERS; ++i) {
-					dir.rotate(TETA / NBLASERS);
-					dir.normalize();
-					double dist = world.normalizedDistRay(dir, maxDist, s);
-					g.setInputConcentration(std::to_string(i), dist);
-				}
-				g.step();
-				bool tleft = g.getOutputConcentration("l0") > g.getOutputConcentration("l1");
-				bool tright = g.getOutputConcentration("r0") > g.getOutputConcentration("r1");
-				bool thrust = g.getOutputConcentration("t0") > g.getOutputConcentration("t1");
-				if (tleft && !tright)
-					s.rotate(1.0, world.dt * TURNSPEED);
-				else if (!tleft && tright)
-					s.rotate(-1.0, world.dt * TURNSPEED);
-				if (thrust) s.thrust(world.dt);
-				world.update();
-				finished = world.collided || world.countdown <= 0;
+			runShared(gs, world, heights.data());
+			for (size_t i = first; i < last; ++i) dist[i * NRUN + r] = heights[i - first];
+		});
+		vector<EvalResult> results(n);
+		for (size_t i = 0; i < n; ++i) {
+			double d = 0;
+			for (int r = 0; r < NRUN; ++r) d += dist[i * NRUN + r];
+			results[i].fitness = d / static_cast<double>(NRUN);
+			results[i].runs = NRUN;
+			begin[i].fitnesses["distance"] = results[i].fitness;
+		}
+		return results;
+	}
+
+	template <typename It>
+	static vector<EvalResult> evaluatePopulation(It begin, It end, size_t nbThreads = 0,
+	                                             bool pin = false,
+	                                             const EvalBudget &budget = EvalBudget()) {
+		ThreadPool pool(nbThreads, pin);
+		return evaluatePopulation(begin, end, pool, budget);
+	}
+
+	// one controller step: feeds the orientation and the laser distances, reads the actuators
+	template <typename G, typename T>
+	static Actions step(G &g, const Handles<G> &h, const BasicV<T> &orientation,
+	                    const T *dists) {
+		sense(g, h, orientation, dists);
+		{
+			SHIPESCAPE_PROFILE_SCOPE(CONTROLLER);
+			g.step();
+		}
+		return act(g, h);
+	}
+	// the parts of step around the controller's own step
+	template <typename G, typename T>
+	static void sense(G &g, const Handles<G> &h, const BasicV<T> &orientation, const T *dists) {
+		typedef ControllerIO<G> IO;
+		IO::set(g, h.c, orientation.x * 0.5 + 0.5);
+		IO::set(g, h.s, orientation.y * 0.5 + 0.5);
+		for (size_t i = 0; i < h.lasers.size(); ++i) IO::set(g, h.lasers[i], dists[i]);
+	}
+	template <typename G> static Actions act(G &g, const Handles<G> &h) {
+		typedef ControllerIO<G> IO;
+		Actions a;
+		a.left = IO::get(g, h.l0) > IO::get(g, h.l1);
+		a.right = IO::get(g, h.r0) > IO::get(g, h.r1);
+		a.thrust = IO::get(g, h.t0) > IO::get(g, h.t1);
+		return a;
+	}
+
+	template <typename T> static void apply(const Actions &a, BasicShip<T> &s, T dt) {
+		if (a.left && !a.right)
+			s.rotate(1.0, dt * TURNSPEED);
+		else if (!a.left && a.right)
+			s.rotate(-1.0, dt * TURNSPEED);
+		if (a.thrust) s.thrust(dt);
+	}
+
+	// distance reached by a copy of the controller on the course of run r. Copying the
+	// controller and resolving its handles is the only allocating part: once the obstacle
+	// window is set up by the first update, the loop itself doesn't allocate.
+	// observer(world, actions) is called after every step. With stallTime > 0 the run is
+	// stopped (and *stalled set) once the height hasn't improved for that long.
+	// evaluateRun<float>(...) flies the run in a single precision world.
+	template <typename T = double, typename G, typename O = NoObserver>
+	static double evaluateRun(const G &dna, int r, O &&observer = O(), double stallTime = 0,
+	                          bool *stalled = nullptr) {
+		G g = dna;
+		BasicWorld<T> world;
+		world.seedOffset = r * 1000;
+		return run(g, world, observer, stallTime, stalled);
+	}
+
+	// flies the controller in the world until the run ends and returns the height reached.
+	// Controller and world may be copies taken in the middle of an earlier run (see
+	// World::snapshot), which then resumes exactly where it was.
+	template <typename G, typename T, typename O = NoObserver>
+	static double run(G &g, BasicWorld<T> &world, O &&observer = O(), double stallTime = 0,
+	                  bool *stalled = nullptr) {
+		SHIPESCAPE_PROFILE_SCOPE(RUN);
+		const Handles<G> handles(g, world.sensors.size());
+		SensorReadings<T> sensors(world.sensors);
+		const T maxDist = world.MAXH;
+		auto &s = world.ships.at(0);
+		beginRun(observer, world, 0);
+		bool finished = world.finished(s);
+		double bestY = s.position.y, lastProgress = world.currentTime;
 #ifdef DISPLAY
-				if (finished) window.close();
+		ShipWindow<BasicWorld<T>> *window = nullptr;
 #endif
-			};
+		// the controller decides every world.controlPeriod steps, its actions are held between
+		Actions a;
+		int sinceControl = 0;
+		auto stepFunc = [&]() {
+			if (sinceControl++ % max(1, world.controlPeriod) == 0) {
+				sensors.read(world.sensors, s.orientation, maxDist,
+				             [&](const BasicV<T> *dirs, size_t n, T m, T *out) {
+					             world.castFan(s, dirs, n, m, out);
+				             });
+				a = step(g, handles, s.orientation, sensors.values.data());
+			}
+			apply(a, s, world.dt);
+			world.update();
+			SHIPESCAPE_PROFILE_COUNT(STEPS, 1);
+			observer(world, a);
+			finished = world.finished(s);
+			if (s.position.y > bestY) {
+				bestY = s.position.y;
+				lastProgress = world.currentTime;
+			} else if (stallTime > 0 && world.currentTime - lastProgress > stallTime && !finished) {
+				finished = true;
+				if (stalled) *stalled = true;
+			}
 #ifdef DISPLAY
-			window.setFormat(f);
-			window.resize(800, 800);
-			window.show();
-			window.setAnimating(true);
-			app.exec();
+			if (finished) window->close();
 #endif
-			while (!finished) stepFunc();
-			d += s.position.y;
-		}
-		ind.fitnesses["distance"] = d / static_cast<double>(NRUN);
-
+		};
 #ifdef DISPLAY
-		std::cerr << "Fitness = " << ind.fitnesses["distance"] << std::endl;
+		// the window runs stepFunc at the world's dt, whatever its frame rate
+		int argc = 1;
+		char name[] = "shipEscape";
+		char *argv[] = {name, nullptr};
+		QGuiApplication app(argc, argv);
+		QSurfaceFormat f;
+		f.setSamples(8);
+		ShipWindow<BasicWorld<T>> w(world, stepFunc);
+		window = &w;
+		w.setFormat(f);
+		w.resize(800, 800);
+		w.show();
+		w.setAnimating(true);
+		app.exec();
 #endif
+		while (!finished) stepFunc();
+		return s.position.y;
+	}
+
+	// flies controller i as ship i of the world, all of them on the same course, until every
+	// ship is finished. heights[i] receives the height ship i reached, which is what run()
+	// would return for that controller alone.
+	template <typename G, typename T>
+	static void runShared(vector<G> &gs, BasicWorld<T> &world, double *heights) {
+		SHIPESCAPE_PROFILE_SCOPE(RUN);
+		const T maxDist = world.MAXH;
+		vector<Handles<G>> handles;
+		handles.reserve(gs.size());
+		for (auto &g : gs) handles.emplace_back(g, world.sensors.size());
+		vector<SensorReadings<T>> sensors(gs.size(), SensorReadings<T>(world.sensors));
+		vector<Actions> actions(gs.size());
+		world.setShips(gs.size());
+		for (int k = 0; !world.finished(); ++k) {
+			bool control = k % max(1, world.controlPeriod) == 0;
+			for (size_t i = 0; i < gs.size(); ++i) {
+				auto &s = world.ships[i];
+				if (world.finished(s)) continue;
+				if (control) {
+					sensors[i].read(world.sensors, s.orientation, maxDist,
+					                [&](const BasicV<T> *dirs, size_t n, T m, T *out) {
+						                world.castFan(s, dirs, n, m, out);
+					                });
+					actions[i] = step(gs[i], handles[i], s.orientation, sensors[i].values.data());
+				}
+				apply(actions[i], s, world.dt);
+			}
+			world.update();
+			SHIPESCAPE_PROFILE_COUNT(STEPS, 1);
+		}
+		for (size_t i = 0; i < gs.size(); ++i) heights[i] = world.ships[i].position.y;
 	}
 };
 }
@@ -0,0 +1,989 @@
+#define SHIPESCAPE_ALLOC_COUNTER
+#include "../alloccount.hpp"
+
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../distributed.hpp"
+#include "../fitnesscache.hpp"
+#include "../philox.hpp"
+#include "../replay.hpp"
+#include "../ship.hpp"
+#include "../visibility.hpp"
+#include "../worldbatch.hpp"
+#include "../bench/stubcontroller.hpp"
+#include "../viewer/particlepool.hpp"
+#include "../viewer/simloop.hpp"
+#include "../exporter/scene.hpp"
+
+using namespace ShipEscape;
+
+// Equivalence checks of the simulation: every fast path against the one it stands for, bit
+// for bit. Each case is its own ctest.
+// usage: shipescape_tests [case...]   (all cases without arguments)
+
+struct Checks {
+	size_t failed = 0, total = 0;
+	// counts a check, and reports the first few that fail
+	bool expect(bool ok, const char *what, double a = 0, double b = 0) {
+		++total;
+		if (!ok && failed++ < 10) printf("  FAILED %s: %.17g vs %.17g\n", what, a, b);
+		return ok;
+	}
+	bool same(double a, double b, const char *what) { return expect(a == b, what, a, b); }
+};
+
+static vector<StubIndividual> population(size_t n) {
+	vector<StubIndividual> pop(n);
+	for (size_t i = 0; i < n; ++i) {
+		pop[i].dna = shipXP::randomInit<StubController>();
+		pop[i].dna.bias = 0.13 * (static_cast<double>(i) - n / 2.0);
+		pop[i].dna.phase = static_cast<unsigned int>(i);
+	}
+	return pop;
+}
+
+// rays all around the ship
+template <typename T> static vector<BasicV<T>> circle(size_t n) {
+	vector<BasicV<T>> dirs(n);
+	for (size_t i = 0; i < n; ++i) {
+		double a = 2.0 * M_PI * (i + 0.3) / n;
+		dirs[i] = BasicV<T>(static_cast<T>(cos(a)), static_cast<T>(sin(a)));
+	}
+	return dirs;
+}
+
+// a scripted flight: turns in slow waves and thrusts two steps out of three
+template <typename Wd> static void pilot(Wd &w, int k) {
+	auto &s = w.ships.at(0);
+	s.rotate(((k / 60) % 3) - 1.0, w.dt * 2);
+	if (k % 3) s.thrust(w.dt);
+}
+
+// castFan against normalizedDistRay, in every casting mode and in both precisions
+template <typename T> static void fansOf(Checks &c) {
+	for (auto mode : {RayCasting::window, RayCasting::traversal, RayCasting::distanceField}) {
+		for (int run = 0; run < 4; ++run) {
+			BasicWorld<T> w;
+			w.seedOffset = run * 1000;
+			w.rayCasting = mode;
+			w.obstacleDensity *= 1 + run;
+			auto &s = w.ships[0];
+			auto dirs = circle<T>(97);
+			vector<T> fan(dirs.size());
+			for (int k = 0; k < 2000 && !w.finished(s); ++k) {
+				if (k % 5 == 0) {
+					w.castFan(s, dirs.data(), dirs.size(), w.MAXH, fan.data());
+					for (size_t i = 0; i < dirs.size(); ++i)
+						c.same(fan[i], w.normalizedDistRay(dirs[i], w.MAXH, s), "castFan");
+				}
+				pilot(w, k);
+				w.update();
+			}
+		}
+	}
+}
+static void fans(Checks &c) {
+	fansOf<double>(c);
+	fansOf<float>(c);
+}
+
+// the three casting modes read the same distances, and so fly the same runs
+static void casting(Checks &c) {
+	for (double density : {1.0, 6.0}) {
+		for (int run = 0; run < 4; ++run) {
+			World w[3];
+			const RayCasting modes[3] = {RayCasting::window, RayCasting::traversal,
+			                             RayCasting::distanceField};
+			for (int m = 0; m < 3; ++m) {
+				w[m].seedOffset = run * 1000;
+				w[m].obstacleDensity *= density;
+				w[m].rayCasting = modes[m];
+			}
+			auto dirs = circle<double>(101);
+			vector<double> fan[3];
+			for (int k = 0; k < 2000 && !w[0].finished(w[0].ships[0]); ++k) {
+				if (k % 7 == 0) {
+					for (int m = 0; m < 3; ++m) {
+						fan[m].resize(dirs.size());
+						w[m].castFan(w[m].ships[0], dirs.data(), dirs.size(), w[m].MAXH,
+						             fan[m].data());
+					}
+					for (size_t i = 0; i < dirs.size(); ++i) {
+						c.same(fan[1][i], fan[0][i], "traversal vs window");
+						c.same(fan[2][i], fan[0][i], "distanceField vs window");
+					}
+				}
+				for (int m = 0; m < 3; ++m) {
+					pilot(w[m], k);
+					w[m].update();
+				}
+				for (int m = 1; m < 3; ++m)
+					c.same(w[m].ships[0].position.y, w[0].ships[0].position.y, "casting mode run");
+			}
+		}
+	}
+}
+
+// WorldBatch lanes against separate worlds driven the same way
+static void batch(Checks &c) {
+	const size_t N = 16;
+	WorldBatch b(N);
+	vector<World> ws(N);
+	for (size_t i = 0; i < N; ++i) {
+		ws[i].seedOffset = static_cast<int>(i) * 1000;
+		b.reset(i, static_cast<int>(i) * 1000);
+	}
+	V dir(0.3, 0.95);
+	dir.normalize();
+	for (int k = 0; b.nbActive() > 0 && k < 20000; ++k) {
+		vector<uint8_t> was = b.active;
+		for (size_t i = 0; i < N; ++i) {
+			if (!was[i]) continue;
+			double r = ((k / 40 + static_cast<int>(i)) % 3) - 1.0;
+			ws[i].ships[0].rotate(r, ws[i].dt * 8);
+			b.rotate(i, r, b.params.dt * 8);
+			if ((k + i) % 4) {
+				ws[i].ships[0].thrust(ws[i].dt);
+				b.thrust(i, b.params.dt);
+			}
+			c.same(b.normalizedDistRay(i, dir, 100),
+			       ws[i].normalizedDistRay(dir, 100, ws[i].ships[0]), "lane ray");
+		}
+		b.update();
+		for (size_t i = 0; i < N; ++i) {
+			if (!was[i]) continue;
+			ws[i].update();
+			const Ship &s = ws[i].ships[0];
+			c.same(b.px[i], s.position.x, "lane x");
+			c.same(b.py[i], s.position.y, "lane y");
+			c.same(b.countdown[i], s.countdown, "lane countdown");
+			c.expect(static_cast<bool>(b.collided[i]) == s.collided, "lane collided");
+		}
+	}
+}
+
+// The default (legacy) obstacles and (discrete) collisions, with window casting, fly the
+// courses of the original engine. Its pilot steers toward the longest of 11 rays; the hash
+// covers every ray it read and every position it went through.
+static void baseline(Checks &c) {
+	const struct {
+		int steps;
+		uint64_t hash;
+	} golden[] = {{38, 0x3622d19ecd00e35dull},  {150, 0x7fb1f1e751edff37ull},
+	              {82, 0xfe23b2016498ba45ull},  {119, 0xff5a9cfaf4917400ull},
+	              {185, 0x2a90dd8ced464706ull}, {77, 0x44caaee769748138ull}};
+	for (int run = 0; run < 6; ++run) {
+		World w;
+		w.seedOffset = run * 1000;
+		w.rayCasting = RayCasting::window;
+		Ship &s = w.ships[0];
+		StableHash h;
+		int k = 0;
+		while (!w.finished(s) && k < 20000) {
+			++k;
+			double best = -1;
+			int bi = 0;
+			V dir = s.orientation;
+			dir.rotate(-M_PI * 0.6);
+			for (int i = 0; i < 11; ++i) {
+				dir.rotate(M_PI * 1.2 / 11);
+				dir.normalize();
+				double d = w.normalizedDistRay(dir, 104, s);
+				h.add(d);
+				if (d > best) {
+					best = d;
+					bi = i;
+				}
+			}
+			s.rotate(bi < 5 ? -1 : (bi > 5 ? 1 : 0), w.dt * 8);
+			s.thrust(w.dt);
+			w.update();
+			h.add(s.position.x).add(s.position.y);
+		}
+		c.same(k, golden[run].steps, "baseline steps");
+		c.expect(h.value() == golden[run].hash, "baseline course");
+	}
+}
+
+// once the first step has set the obstacle window up, runs don't allocate
+static void allocs(Checks &c) {
+	auto pop = population(12);
+	for (auto &ind : pop) {
+		for (int r = 0; r < shipXP::NRUN; ++r) {
+			size_t a0 = 0, n = 0;
+			shipXP::evaluateRun(ind.dna, r, [&](const World &, const shipXP::Actions &) {
+				if (n++ == 0) a0 = AllocCounter::count();
+			});
+			c.same(static_cast<double>(AllocCounter::count() - a0), 0, "allocations after warm-up");
+		}
+	}
+}
+
+static void sameResults(Checks &c, const vector<shipXP::EvalResult> &a,
+                        const vector<shipXP::EvalResult> &b, const char *what) {
+	if (!c.expect(a.size() == b.size(), what, a.size(), b.size())) return;
+	for (size_t i = 0; i < a.size(); ++i) {
+		c.same(a[i].fitness, b[i].fitness, what);
+		c.same(a[i].runs, b[i].runs, what);
+		c.expect(a[i].partial == b[i].partial, what);
+	}
+}
+
+// every other way of evaluating a population gives evaluatePopulation's results
+static void evaluation(Checks &c) {
+	auto pop = population(19);
+	pop.push_back(pop[3]);  // a clone, for the cache
+	RemoteConfig config;
+	config.heartbeat = 0.05;
+	RemoteEvaluator<StubController>::Options options;
+	options.batchSize = 3;
+	RemoteEvaluator<StubController> remote(config, options);
+	remote.spawnLocal(3);
+	ThreadPool pool(3);
+	shipXP::EvalBudget budget;
+	budget.stallTime = 3;
+	for (int pass = 0; pass < 2; ++pass) {
+		if (pass) {
+			budget.targetFitness = 40;
+			budget.maxRunFitness = 60;
+		}
+		auto ref = shipXP::evaluatePopulation(pop.begin(), pop.end(), pool, budget);
+		FitnessCache cache;
+		for (int k = 0; k < 2; ++k)
+			sameResults(c, shipXP::evaluatePopulation(pop.begin(), pop.end(), pool, cache, budget),
+			            ref, "cached");
+		c.same(static_cast<double>(cache.hits()), pop.size(), "cache hits");
+		sameResults(c, remote.evaluatePopulation(pop.begin(), pop.end(), budget), ref, "remote");
+	}
+	auto ref = shipXP::evaluatePopulation(pop.begin(), pop.end(), pool);
+	sameResults(c, shipXP::evaluateShared(pop.begin(), pop.end(), pool), ref, "shared");
+}
+
+// a controller that never does anything: its ship gains no height before the doors close
+struct Idle : StubController {
+	void step() {}
+};
+
+// budgets that cut evaluations short: a stalled run is stopped stallTime after its last
+// progress, and runs that can't bring the mean up to the target are skipped
+static void budget(Checks &c) {
+	Idle idle = shipXP::randomInit<Idle>();
+	size_t full = 0, cut = 0;
+	bool stalled = false;
+	const double h = shipXP::evaluateRun(idle, 0, [&](const World &, const shipXP::Actions &) {
+		++full;
+	});
+	const double hc = shipXP::evaluateRun(
+	    idle, 0, [&](const World &, const shipXP::Actions &) { ++cut; }, 2.0, &stalled);
+	const World w;
+	c.expect(stalled, "stalled");
+	c.expect(cut < full, "stall cuts the run", static_cast<double>(cut), full);
+	c.expect(cut * w.dt <= 2.0 + 2 * w.dt, "stall time", cut * w.dt, 2.0);
+	c.same(hc, h, "stalled height");
+	shipXP::EvalBudget stall;
+	stall.stallTime = 2.0;
+	shipXP::EvalResult r = shipXP::evaluateRuns(idle, stall);
+	c.expect(r.partial, "stalled runs partial");
+	c.same(r.runs, shipXP::NRUN, "stalled runs flown");
+
+	// the runs a pilot that flies reaches, then a target it can only meet if its second run
+	// beats maxRunFitness
+	StubController g = population(1)[0].dna;
+	shipXP::EvalResult all = shipXP::evaluateRuns(g);
+	c.expect(!all.partial, "default budget");
+	c.same(all.runs, shipXP::NRUN, "default runs");
+	const double d0 = shipXP::evaluateRun(g, 0);
+	shipXP::EvalBudget target;
+	target.maxRunFitness = d0 + 1;
+	target.targetFitness = d0 + 0.75;
+	r = shipXP::evaluateRuns(g, target);
+	c.expect(r.partial, "hopeless partial");
+	c.same(r.runs, 1, "hopeless runs flown");
+	c.same(r.fitness, d0 / shipXP::NRUN, "hopeless fitness");
+	target.targetFitness = 1e9;
+	r = shipXP::evaluateRuns(g, target);
+	c.same(r.runs, 0, "hopeless from the start");
+	c.same(r.fitness, 0, "nothing flown");
+	target.targetFitness = d0 + 0.5;
+	r = shipXP::evaluateRuns(g, target);
+	c.same(r.runs, shipXP::NRUN, "reachable target");
+	c.same(r.fitness, all.fitness, "reachable fitness");
+}
+
+// Workers that fail on cue: one forked while workerFault is set does that to itself on the
+// first genome it is sent. Workers respawned once it is cleared behave. Genomes can be sent
+// with padding, to make tasks larger than socket buffers.
+enum class Fault { none, crash, freeze };
+static Fault workerFault = Fault::none;
+struct Faulty : StubController {
+	size_t padding = 0;
+};
+struct FaultyIndividual {
+	Faulty dna;
+	std::map<std::string, double> fitnesses;
+};
+namespace ShipEscape {
+template <> struct GenomeCodec<Faulty> {
+	static string encode(const Faulty &g) {
+		return GenomeCodec<StubController>::encode(g) + string(g.padding, '\0');
+	}
+	static Faulty decode(const string &s) {
+		if (workerFault == Fault::crash) raise(SIGKILL);
+		if (workerFault == Fault::freeze) raise(SIGSTOP);  // heartbeats included
+		Faulty g;
+		static_cast<StubController &>(g) = GenomeCodec<StubController>::decode(s);
+		return g;
+	}
+};
+}
+
+// workers lost mid-task (hung up, silent, sending garbage) don't change the results, remote
+// replays are the runs evaluateRun records, and a worker busy sending a result larger than
+// the socket buffers while the master has a task as large for it doesn't deadlock them
+static void remote(Checks &c) {
+	auto pop = population(12);
+	vector<FaultyIndividual> faulty(pop.size());
+	for (size_t i = 0; i < pop.size(); ++i)
+		static_cast<StubController &>(faulty[i].dna) = pop[i].dna;
+	ThreadPool pool(2);
+	shipXP::EvalBudget budget;
+	budget.stallTime = 3;
+	auto ref = shipXP::evaluatePopulation(pop.begin(), pop.end(), pool, budget);
+
+	RemoteConfig config;
+	config.heartbeat = 0.05;
+	RemoteEvaluator<Faulty>::Options options;
+	options.batchSize = 2;
+	options.timeout = 0.5;
+	options.maxAttempts = 5;
+	RemoteEvaluator<Faulty> remote(config, options);
+	// takes the configuration, then answers its first task with a frame too large to be one
+	int sv[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	std::thread garbage([&]() {
+		Wire::Type t;
+		vector<uint8_t> b;
+		const uint8_t junk[5] = {0xff, 0xff, 0xff, 0xff, Wire::RESULT};
+		if (Wire::recv(sv[1], t, b) && Wire::recv(sv[1], t, b)) send(sv[1], junk, 5, MSG_NOSIGNAL);
+		while (Wire::recv(sv[1], t, b)) {
+		}
+		close(sv[1]);
+	});
+	c.expect(remote.addWorker(sv[0]), "garbage worker added");
+	workerFault = Fault::crash;
+	remote.spawnLocal(1);
+	workerFault = Fault::freeze;
+	remote.spawnLocal(1);
+	workerFault = Fault::none;
+	sameResults(c, remote.evaluatePopulation(faulty.begin(), faulty.end(), budget), ref, "faults");
+	garbage.join();
+	c.same(static_cast<double>(remote.lostWorkers()), 3, "lost workers");
+	c.same(static_cast<double>(remote.size()), 2, "respawned workers");
+	for (size_t i = 0; i < pop.size(); ++i)
+		c.same(faulty[i].fitnesses["distance"], ref[i].fitness, "fitness set");
+
+	vector<vector<uint8_t>> replays;
+	sameResults(c, remote.evaluatePopulation(faulty.begin(), faulty.end(), budget, &replays), ref,
+	            "with replays");
+	for (size_t i = 0; i < pop.size(); ++i) {
+		for (int r = 0; r < shipXP::NRUN; ++r) {
+			ReplayRecorder rec;
+			shipXP::evaluateRun(pop[i].dna, r, rec, budget.stallTime);
+			c.expect(replays.at(i * shipXP::NRUN + r) == rec.data(), "remote replay");
+		}
+	}
+
+	const int buffer = 4096;
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	for (int fd : sv) {
+		setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+	}
+	std::thread worker([&]() { RemoteEvaluator<Faulty>::serve(sv[1]); });
+	{
+		options.batchSize = 6;
+		RemoteEvaluator<Faulty> busy(config, options);
+		c.expect(busy.addWorker(sv[0]), "busy worker added");
+		for (auto &ind : faulty) ind.dna.padding = 16 * buffer;
+		sameResults(c, busy.evaluatePopulation(faulty.begin(), faulty.end(), budget, &replays),
+		            ref, "large frames");
+	}
+	worker.join();
+}
+
+// a run stopped, snapshot and resumed (or restored elsewhere, or forked) ends as if it had
+// never stopped
+static void snapshot(Checks &c) {
+	struct Stop {};
+	auto pop = population(12);
+	for (size_t k = 0; k < pop.size(); ++k) {
+		const StubController &dna = pop[k].dna;
+		StubController g1 = dna, g2 = dna;
+		World w1, w2;
+		w1.seedOffset = w2.seedOffset = static_cast<int>(k % 3) * 1000;
+		const double full = shipXP::run(g1, w1);
+		World::State state;
+		int n = 0;
+		bool stopped = false;
+		try {
+			shipXP::run(g2, w2, [&](const World &w, const shipXP::Actions &) {
+				if (++n == 20 + static_cast<int>(k) * 5) {
+					state = w.snapshot();
+					throw Stop();
+				}
+			});
+		} catch (Stop &) {
+			stopped = true;
+		}
+		if (!stopped) continue;  // ended before
+		StubController g3 = g2, g4 = g2;
+		World forked = w2.fork();
+		World restored;
+		restored.restore(state);
+		c.same(shipXP::run(g2, w2), full, "resumed");
+		c.same(shipXP::run(g3, restored), full, "restored");
+		c.same(shipXP::run(g4, forked), full, "forked");
+	}
+}
+
+// a replay plays the recorded run back exactly, from the start or from any step it seeks
+// to, and recording the same run twice gives the same bytes
+static void replays(Checks &c) {
+	auto pop = population(8);
+	for (size_t k = 0; k < pop.size(); ++k) {
+		const int r = static_cast<int>(k % 2);
+		ReplayRecorder rec(64), again(64);
+		const double d = shipXP::evaluateRun(pop[k].dna, r, rec);
+		shipXP::evaluateRun(pop[k].dna, r, again);
+		c.expect(rec.data() == again.data(), "replay bytes");
+		vector<V> trajectory;
+		shipXP::evaluateRun(pop[k].dna, r, [&](const World &w, const shipXP::Actions &) {
+			trajectory.push_back(w.ships[0].position);
+		});
+		ReplayPlayer p;
+		if (!c.expect(p.load(rec.data()), "replay loads")) continue;
+		c.same(static_cast<double>(p.size()), trajectory.size(), "replay steps");
+		while (p.advance() && p.position() <= trajectory.size()) {
+			c.same(p.world.ships[0].position.x, trajectory[p.position() - 1].x, "replay x");
+			c.same(p.world.ships[0].position.y, trajectory[p.position() - 1].y, "replay y");
+		}
+		c.same(p.world.ships[0].position.y, d, "replay end");
+		for (size_t j = 0; j < 12 && !trajectory.empty(); ++j) {
+			size_t step = 1 + (j * 7919) % trajectory.size();
+			p.seek(step);
+			c.same(p.world.ships[0].position.y, trajectory[step - 1].y, "replay seek");
+		}
+	}
+}
+
+// distance from the origin of a triangle fan to its boundary along dir
+static double fanDist(const vector<V> &fan, const V &dir) {
+	double best = numeric_limits<double>::infinity();
+	for (size_t i = 2; i < fan.size(); ++i) {
+		V a = fan[i - 1] - fan[0], s = fan[i] - fan[i - 1];
+		double den = dir.x * s.y - dir.y * s.x;
+		if (den == 0) continue;
+		double t = (a.x * s.y - a.y * s.x) / den, u = (a.x * dir.y - a.y * dir.x) / den;
+		if (t > 0 && u >= -1e-9 && u <= 1 + 1e-9) best = min(best, t);
+	}
+	return best;
+}
+// the lit region against castRay along many rays, grazing ones included. Not bit for bit:
+// its arcs are polygons, within tolerance.
+static void visibility(Checks &c) {
+	Visibility vis;
+	auto dirs = circle<double>(30000);
+	for (int run = 0; run < 3; ++run) {
+		World w;
+		w.seedOffset = run * 1000;
+		w.rayCasting = RayCasting::window;
+		auto &s = w.ships[0];
+		for (int k = 0; k < 600 && !w.finished(s); ++k) {
+			// past the next door before the doors reset, castRay still stops at its line
+			if (k % 20 == 0 && s.position.y < w.doors(s).nextReset) {
+				vis.compute(w, s, w.MAXH);
+				for (auto &dir : dirs) {
+					double d = w.normalizedDistRay(dir, w.MAXH, s);
+					double f = fanDist(vis.fan, dir);
+					c.expect(fabs(f - d) <= vis.tolerance, "visibility", f, d);
+				}
+			}
+			pilot(w, k);
+			w.update();
+		}
+	}
+}
+
+// the exporter's frames of a recorded run, against their known hashes. A door resets on the
+// way (closedSize 0) and an empty rectangle leaves the frame as it was.
+static void exporter(Checks &c) {
+	Frame empty;
+	empty.resize(8, 8);
+	empty.lookAt(0, 0, 10);
+	empty.clear(Color{0.2f, 0.4f, 0.6f, 1});
+	const vector<uint8_t> before = empty.rgb;
+	empty.rect(1, -5, 1, 5, Color{1, 0, 0, 1}, Color{0, 1, 0, 1});
+	empty.rect(-5, 2, 5, 2, Color{1, 0, 0, 1}, Color{0, 1, 0, 1});
+	c.expect(empty.rgb == before, "empty rect");
+
+	auto pop = population(8);
+	ReplayRecorder rec(64);
+	shipXP::evaluateRun(pop[1].dna, 1, rec);
+	ReplayPlayer player;
+	if (!c.expect(player.load(rec.data()), "replay loads")) return;
+	const World &w = player.world;
+	Camera camera{w.ships.at(0).position.x, w.ships.at(0).position.y};
+	Frame frame;
+	frame.resize(96, 96);
+	vector<uint8_t> mask;
+	StableHash all;
+	size_t frames = 0, openDoors = 0;
+	while (player.advance()) {
+		camera.follow(w.ships.at(0).position.x, w.ships.at(0).position.y, w.dt);
+		if (player.position() % 5) continue;
+		renderFrame(w, FrameState{w.snapshot(), camera.x, camera.y}, frame, mask);
+		all.bytes(frame.rgb.data(), frame.rgb.size());
+		openDoors += w.doors(w.ships.at(0)).closedSize == 0;
+		++frames;
+	}
+	c.expect(frames == 34 && openDoors == 1, "frames rendered", frames, openDoors);
+	c.expect(all.value() == 0xfdb91f3286671eefull, "frame hashes");
+}
+
+// the viewer's fixed steps, and its states taken once per frame: copies that share nothing
+// with the world, made without allocating once warm, and read back across threads
+static void simloop(Checks &c) {
+	FixedStepLoop loop;
+	int steps = 0;
+	auto step = [&]() { ++steps; };
+	c.same(static_cast<double>(loop.advance(0.05, step)), 3, "steps in 0.05s");
+	c.expect(loop.alpha() >= 0 && loop.alpha() < 1, "alpha", loop.alpha());
+	loop.speed = 2;
+	c.same(static_cast<double>(loop.advance(0.05, step)), 6, "steps at speed 2");
+	loop.speed = 1;
+	c.same(static_cast<double>(loop.advance(10, step)), 15, "hiccup dropped");
+	loop.paused = true;
+	c.same(static_cast<double>(loop.advance(1, step)), 0, "paused");
+	c.same(steps, 24, "steps run");
+
+	World shown;
+	for (int run = 0; run < 4; ++run) {
+		World w;
+		w.seedOffset = run * 1000;
+		World::State st;
+		size_t a0 = 0;
+		for (int k = 0; k < 1500 && !w.finished(w.ships[0]); ++k) {
+			if (k == 1) a0 = AllocCounter::count();
+			pilot(w, k);
+			w.update();
+			w.snapshot(st);
+			shown.copyFrom(st);
+			c.expect(!w.obstacles.shared() && !shown.obstacles.shared(), "nothing shared");
+			c.same(shown.ships[0].position.y, w.ships[0].position.y, "copied state");
+			c.same(shown.normalizedDistRay(V(0, 1), w.MAXH, shown.ships[0]),
+			       w.normalizedDistRay(V(0, 1), w.MAXH, w.ships[0]), "copied obstacles");
+		}
+		c.same(static_cast<double>(AllocCounter::count() - a0), 0, "allocations per frame");
+	}
+
+	World live;
+	FixedStepLoop fast;
+	fast.uncapped = true;
+	fast.frameBudget = 0.002;
+	int k = 0;
+	SimThread<World> sim(live, fast, [&]() {
+		pilot(live, k++);
+		live.update();
+	});
+	sim.start();
+	vector<Ship> prev;
+	double alpha, last = 0;
+	for (int frame = 0; frame < 100; ++frame) {
+		sim.read(prev, shown, alpha);
+		c.expect(shown.currentTime >= last, "time goes forward", shown.currentTime, last);
+		c.expect(prev.size() == shown.ships.size() && alpha >= 0 && alpha <= 1, "read");
+		last = shown.currentTime;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	sim.stop();
+	c.expect(last > 0, "published", last);
+	c.expect(!live.obstacles.shared(), "live world shares nothing");
+}
+
+// Philox against its published known answers, obstacles computed on their own against whole
+// cells, and the streams of different courses apart where legacy seeds collide
+static void obstacles(Checks &c) {
+	const uint32_t kat[3][10] = {
+	    {0, 0, 0, 0, 0, 0, 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8},
+	    {~0u, ~0u, ~0u, ~0u, ~0u, ~0u, 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd},
+	    {0xa4093822, 0x299f31d0, 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344, 0xd16cfe09,
+	     0x94fdcceb, 0x5001e420, 0x24126ea1}};
+	for (auto &k : kat) {
+		uint32_t u[4];
+		Philox::block(k[0], k[1], k[2], k[3], k[4], k[5], u);
+		for (int i = 0; i < 4; ++i) c.same(u[i], k[6 + i], "philox known answer");
+	}
+
+	for (auto rng : {ObstacleRng::counter, ObstacleRng::legacy}) {
+		World w;
+		w.obstacleRng = rng;
+		w.obstacleDensity *= 5;
+		vector<Circle> cell;
+		for (int offset : {0, 1000, 39}) {
+			for (int n = -3; n < 40; ++n) {
+				cell.clear();
+				w.generateCell(n, offset, cell);
+				size_t a0 = AllocCounter::count();
+				for (size_t i = 0; i < cell.size(); ++i) {
+					Circle o = w.obstacleAt(n, static_cast<int>(i), offset);
+					c.same(o.center.x, cell[i].center.x, "obstacleAt x");
+					c.same(o.center.y, cell[i].center.y, "obstacleAt y");
+					c.same(o.radius, cell[i].radius, "obstacleAt radius");
+				}
+				// the counter generator computes an obstacle without drawing its cell
+				if (rng == ObstacleRng::counter)
+					c.same(static_cast<double>(AllocCounter::count() - a0), 0, "obstacleAt cost");
+			}
+		}
+	}
+
+	// cell 0 of course 1000 and cell 31 of course 39 share a legacy seed, not a Philox stream
+	World legacy, counter;
+	counter.obstacleRng = ObstacleRng::counter;
+	for (World *w : {&legacy, &counter}) {
+		Circle a = w->obstacleAt(0, 0, 1000), b = w->obstacleAt(31, 0, 39);
+		c.expect((a.center.x == b.center.x) == (w == &legacy), "colliding seeds", a.center.x,
+		         b.center.x);
+	}
+	std::set<double> first;
+	for (int offset = 0; offset < 20000; offset += 1000)
+		for (int n = 0; n < 200; ++n) first.insert(counter.obstacleAt(n, 0, offset).center.x);
+	c.same(static_cast<double>(first.size()), 20 * 200, "distinct streams");
+}
+
+// a large dt flies straight through obstacles and closed doors unless collisions are swept
+static void collisions(Checks &c) {
+	size_t tunnels[2] = {0, 0};
+	for (auto mode : {Collisions::swept, Collisions::discrete}) {
+		for (int n = 3; n < 60; ++n) {
+			for (int door = 0; door < 2; ++door) {
+				World w;
+				w.dt = 0.25;
+				w.collisions = mode;
+				Ship &s = w.ships[0];
+				V target;
+				if (door) {
+					// the closed part of the next door, half of it closed
+					s.countdown = w.maxCountdown * 0.5;
+					s.nextReset = n * w.gridSize;
+					target = V(1 + (n % 5) * 3, s.nextReset);
+				} else {
+					Circle o = w.obstacleAt(n, n % 3, w.seedOffset);
+					if (o.center.x < 3 || o.center.x > w.W - 3) continue;
+					s.nextReset = 1e6;
+					target = o.center;
+				}
+				s.prevReset = target.y - 20;
+				s.position = target - V(0, 8);
+				s.velocity = V(0, 16 / w.dt);
+				w.update();
+				if (!c.expect(s.position.y > target.y + 4, "passed", s.position.y, target.y))
+					continue;
+				tunnels[mode == Collisions::discrete] += !s.collided;
+			}
+		}
+	}
+	c.same(static_cast<double>(tunnels[0]), 0, "swept tunnels");
+	c.expect(tunnels[1] > 20, "discrete tunnels", static_cast<double>(tunnels[1]));
+}
+
+// sensor rays: the default fan is the original one, each ray is cast every period steps and
+// within its range, due rays of the same range go out as one fan, and what they read is the
+// world's distance along them
+static void sensors(Checks &c) {
+	SensorConfig fan;
+	c.same(static_cast<double>(fan.size()), 11, "default rays");
+	for (size_t i = 0; i < fan.size(); ++i)
+		c.same(fan.rays[i].angle, -(M_PI * 1.2) / 2 + (i + 1.0) * (M_PI * 1.2) / 11,
+		       "default angle");
+
+	SensorConfig cfg(0, 0);
+	cfg.add(-0.5, 0, 1);
+	cfg.add(-0.2, 0, 1);
+	cfg.add(0, 30, 1);
+	cfg.add(0.2, 30, 3);
+	cfg.add(0.5, 500, 2);
+	const double maxDist = 104;
+	SensorReadings<double> r(cfg);
+	for (int step = 0; step < 12; ++step) {
+		vector<double> before = r.values;
+		size_t calls = 0;
+		vector<bool> cast(cfg.size(), false);
+		r.read(cfg, V(0, 1), maxDist, [&](const V *dirs, size_t n, double range, double *out) {
+			++calls;
+			for (size_t k = 0; k < n; ++k) {
+				size_t i = static_cast<size_t>(dirs + k - r.dirs.data());
+				double want = cfg.rays[i].range > 0 ? min(cfg.rays[i].range, maxDist) : maxDist;
+				c.same(range, want, "ray range");
+				cast[i] = true;
+				out[k] = step * 10 + static_cast<double>(i);
+			}
+		});
+		for (size_t i = 0; i < cfg.size(); ++i) {
+			bool due = step % cfg.rays[i].period == 0;
+			c.expect(cast[i] == due, "ray decimation", static_cast<double>(i), step);
+			c.same(r.values[i], due ? step * 10 + static_cast<double>(i) : before[i], "reading");
+		}
+		// {0, 1}, {2} or {2, 3} every third step, and {4} every other step
+		c.same(static_cast<double>(calls), 2.0 + (step % 2 == 0), "fans cast");
+	}
+
+	World w;
+	SensorReadings<double> live(cfg);
+	vector<double> last(cfg.size(), 0);
+	for (int k = 0; k < 300 && !w.finished(w.ships[0]); ++k) {
+		const Ship &s = w.ships[0];
+		live.read(cfg, s.orientation, w.MAXH, [&](const V *dirs, size_t n, double m, double *out) {
+			w.castFan(s, dirs, n, m, out);
+		});
+		for (size_t i = 0; i < cfg.size(); ++i) {
+			if (k % cfg.rays[i].period) {
+				c.same(live.values[i], last[i], "held reading");
+				continue;
+			}
+			double range = cfg.rays[i].range > 0 ? min(cfg.rays[i].range, w.MAXH) : w.MAXH;
+			c.same(live.values[i], w.normalizedDistRay(live.dirs[i], range, s), "live reading");
+		}
+		last = live.values;
+		pilot(w, k);
+		w.update();
+	}
+}
+
+// the float world against the double one, within the drift ship.hpp documents. Open loop: the
+// actions a double run took are replayed in both worlds, so that a different decision of the
+// pilot can't hide the drift
+static void precision(Checks &c) {
+	size_t steps = 0;
+	for (auto &ind : population(4)) {
+		for (int r = 0; r < shipXP::NRUN; ++r) {
+			vector<shipXP::Actions> actions;
+			shipXP::evaluateRun(ind.dna, r, [&](const World &, const shipXP::Actions &a) {
+				actions.push_back(a);
+			});
+			steps += actions.size();
+			World w;
+			BasicWorld<float> f;
+			w.update();
+			f.update();
+			double maxPos = 0, maxRay = 0;
+			for (size_t i = 1; i < actions.size(); ++i) {
+				shipXP::apply(actions[i], w.ships[0], w.dt);
+				shipXP::apply(actions[i], f.ships[0], f.dt);
+				w.update();
+				f.update();
+				V dirs[shipXP::NBLASERS];
+				BasicV<float> fdirs[shipXP::NBLASERS];
+				double dists[shipXP::NBLASERS];
+				float fdists[shipXP::NBLASERS];
+				w.sensors.directions(w.ships[0].orientation, dirs);
+				f.sensors.directions(f.ships[0].orientation, fdirs);
+				w.castFan(w.ships[0], dirs, shipXP::NBLASERS, w.MAXH, dists);
+				f.castFan(f.ships[0], fdirs, shipXP::NBLASERS, f.MAXH, fdists);
+				const auto &p = f.ships[0].position;
+				V d = w.ships[0].position - V(p.x, p.y);
+				maxPos = max(maxPos, sqrt(d.sqLength()));
+				for (int k = 0; k < shipXP::NBLASERS; ++k)
+					maxRay = max(maxRay, fabs(dists[k] - static_cast<double>(fdists[k])));
+			}
+			c.expect(maxPos <= shipXP::FLOAT_POSITION_DRIFT, "position drift", maxPos,
+			         shipXP::FLOAT_POSITION_DRIFT);
+			c.expect(maxRay <= shipXP::FLOAT_RAY_DRIFT, "ray drift", maxRay,
+			         shipXP::FLOAT_RAY_DRIFT);
+		}
+	}
+	c.expect(steps > 500, "replayed steps", static_cast<double>(steps));
+}
+
+// the fitness cache: least recently used entries go first, save / load keeps the entries and
+// their order, a file that isn't a cache leaves it untouched, and concurrent evaluations
+// sharing one get every entry back as it was inserted
+static void fitnessCache(Checks &c) {
+	auto entry = [](uint64_t k) {
+		FitnessCache::Entry e;
+		e.fitness = 0.5 * static_cast<double>(k);
+		e.runs = static_cast<int32_t>(k % 7);
+		e.partial = k % 2;
+		return e;
+	};
+	auto holds = [&](FitnessCache &cache, uint64_t k) {
+		FitnessCache::Entry e;
+		if (!cache.find(k, e)) return false;
+		FitnessCache::Entry want = entry(k);
+		return e.fitness == want.fitness && e.runs == want.runs && e.partial == want.partial;
+	};
+	FitnessCache lru(3);
+	for (uint64_t k = 1; k <= 3; ++k) lru.insert(k, entry(k));
+	c.expect(holds(lru, 1), "lru find");
+	lru.insert(4, entry(4));  // evicts 2, 1 having been used since
+	c.same(static_cast<double>(lru.size()), 3, "lru size");
+	c.expect(!holds(lru, 2), "lru evicted");
+	for (uint64_t k : {1, 3, 4}) c.expect(holds(lru, k), "lru kept", static_cast<double>(k));
+	c.same(static_cast<double>(lru.hits()), 4, "lru hits");
+	c.same(static_cast<double>(lru.misses()), 1, "lru misses");
+	FitnessCache none(0);
+	none.insert(1, entry(1));
+	c.same(static_cast<double>(none.size()), 0, "no capacity");
+
+	// 1, 3 then 4 from least to most recently used
+	const std::string path = "fitnesscache_test.bin";
+	c.expect(lru.save(path), "cache saves");
+	FitnessCache loaded(3);
+	c.expect(loaded.load(path), "cache loads");
+	c.same(static_cast<double>(loaded.size()), 3, "loaded size");
+	loaded.insert(5, entry(5));
+	c.expect(!holds(loaded, 1), "loaded order");
+	for (uint64_t k : {3, 4, 5}) c.expect(holds(loaded, k), "loaded entry", static_cast<double>(k));
+	{
+		std::ofstream f(path, std::ios::binary | std::ios::trunc);
+		f << "SEXD, not a cache";
+	}
+	c.expect(!loaded.load(path), "bad magic");
+	c.same(static_cast<double>(loaded.size()), 3, "untouched by a bad file");
+	std::remove(path.c_str());
+	c.expect(!loaded.load(path), "missing file");
+
+	FitnessCache shared(1000);
+	const int threads = 4, keys = 400;
+	std::vector<std::thread> workers;
+	std::vector<size_t> wrong(threads, 0);
+	for (int t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t]() {
+			for (int pass = 0; pass < 3; ++pass) {
+				for (int i = 0; i < keys; ++i) {
+					// half the keys are every thread's, half its own
+					uint64_t k = i % 2 ? static_cast<uint64_t>(i) : (t + 1) * 100000ull + i;
+					FitnessCache::Entry e;
+					if (!shared.find(k, e))
+						shared.insert(k, entry(k));
+					else if (e.fitness != entry(k).fitness || e.runs != entry(k).runs)
+						++wrong[t];
+				}
+			}
+		});
+	}
+	for (auto &w : workers) w.join();
+	for (int t = 0; t < threads; ++t) c.same(static_cast<double>(wrong[t]), 0, "shared entries");
+	c.same(static_cast<double>(shared.size()), keys / 2 + threads * keys / 2, "shared size");
+	c.same(static_cast<double>(shared.hits() + shared.misses()), 3.0 * threads * keys,
+	       "shared lookups");
+}
+
+// the profiler. Compiled out, its macros record nothing and don't even evaluate their
+// arguments. Compiled in (the profiler_in test), the phases and counters of two runs, one of
+// them on a thread that has exited, add up to the steps and rays the runs went through.
+static void profiler(Checks &c) {
+	Profiler::reset();
+	int evaluated = 0;
+	SHIPESCAPE_PROFILE_COUNT(STEPS, ++evaluated);
+	c.same(evaluated, Profiler::enabled() ? 1 : 0, "count argument");
+	Profiler::reset();
+	StubController g = population(1)[0].dna;
+	size_t steps = 0;
+	auto count = [&](const World &, const shipXP::Actions &) { ++steps; };
+	shipXP::evaluateRun(g, 0, count);
+	std::thread other([&]() { shipXP::evaluateRun(g, 1, count); });
+	other.join();
+	const Profiler::Summary s = Profiler::summary();
+	const double n = Profiler::enabled() ? static_cast<double>(steps) : 0;
+	c.expect(steps > 0, "profiled steps", static_cast<double>(steps));
+	c.same(s.calls[Profiler::RUN], Profiler::enabled() ? 2 : 0, "runs timed");
+	c.expect((s.ns[Profiler::RUN] > 0) == Profiler::enabled(), "run time");
+	for (auto p : {Profiler::PHYSICS, Profiler::COLLISIONS, Profiler::CONTROLLER})
+		c.same(s.calls[p], n, Profiler::name(p));
+	c.same(s.total[Profiler::STEPS], n, "steps counted");
+	c.same(s.samples[Profiler::STEPS], n, "steps samples");
+	c.same(s.total[Profiler::RAYS_CAST], n * shipXP::NBLASERS, "rays counted");
+	c.same(s.samples[Profiler::OBSTACLE_CELLS], n, "window samples");
+	Profiler::reset();
+	const Profiler::Summary r = Profiler::summary();
+	c.same(r.calls[Profiler::RUN] + r.total[Profiler::STEPS], 0, "reset");
+}
+
+// the viewer's particles: a full pool overwrites its oldest slots in ring order, update()
+// moves and ages every particle and kills a share of them without losing the others, quads
+// are written for the live ones only, and nothing allocates after construction
+static void particles(Checks &c) {
+	ParticlePool pool(8);
+	std::mt19937 rng(3);
+	vector<QuadInstance> quads(8);
+	const size_t a0 = AllocCounter::count();
+	for (int i = 0; i < 11; ++i) pool.spawn(static_cast<float>(i), 0, 1, 2);
+	c.same(static_cast<double>(pool.size()), 8, "pool full");
+	pool.instances(quads.data(), 0.5f);
+	// 8, 9 and 10 went into the slots of 0, 1 and 2
+	for (int i = 0; i < 8; ++i)
+		c.same(quads[i].x, i < 3 ? i + 8 : i, "ring order");
+	pool.update(0.25f, 0, rng);
+	c.same(static_cast<double>(pool.size()), 8, "no kill");
+	pool.instances(quads.data(), 0.5f);
+	for (int i = 0; i < 8; ++i) {
+		c.same(quads[i].x, (i < 3 ? i + 8 : i) + 0.25f, "moved x");
+		c.same(quads[i].y, 0.5f, "moved y");
+		c.same(quads[i].z, -1.0f / 1.25f, "aged");
+		c.same(quads[i].sx, 0.5f, "size");
+		c.same(quads[i].color1[3] - quads[i].color2[3], 1, "fade");
+	}
+	pool.clear();
+	for (int i = 0; i < 8; ++i) pool.spawn(static_cast<float>(i), 0, 0, 0);
+	pool.update(1, 0.5f, rng);
+	const size_t kept = pool.size();
+	c.expect(kept > 0 && kept < 8, "half killed", static_cast<double>(kept));
+	pool.instances(quads.data(), 1);
+	float left[8];
+	for (size_t i = 0; i < kept; ++i) left[i] = quads[i].x;
+	std::sort(left, left + kept);
+	c.expect(std::unique(left, left + kept) == left + kept, "survivors distinct");
+	c.expect(left[kept - 1] < 8, "survivors spawned", left[kept - 1]);
+	// old particles have turned from purple to light blue
+	c.expect(fabs(quads[0].color1[0]) + fabs(quads[0].color1[1] - 0.7f) < 1e-5, "old hue",
+	         quads[0].color1[1], 0.7);
+	pool.spawn(0, 0, 0, 0);
+	pool.instances(quads.data(), 1);
+	const float *young = quads[kept].color1;
+	c.expect(fabs(young[0] - 0.8f) + fabs(young[1]) + fabs(young[2] - 1) < 1e-5, "young hue",
+	         young[0], 0.8);
+	pool.update(1, 1, rng);
+	c.same(static_cast<double>(pool.size()), 0, "all killed");
+	c.same(static_cast<double>(AllocCounter::count() - a0), 0, "pool allocations");
+}
+
+int main(int argc, char **argv) {
+	const std::vector<std::pair<std::string, std::function<void(Checks &)>>> cases = {
+	    {"fans", fans},             {"casting", casting},           {"batch", batch},
+	    {"baseline", baseline},     {"allocs", allocs},             {"evaluation", evaluation},
+	    {"remote", remote},         {"snapshot", snapshot},         {"replays", replays},
+	    {"visibility", visibility}, {"exporter", exporter},         {"simloop", simloop},
+	    {"obstacles", obstacles},   {"collisions", collisions},     {"sensors", sensors},
+	    {"precision", precision},   {"fitnesscache", fitnessCache}, {"budget", budget},
+	    {"profiler", profiler},     {"particles", particles}};
+	size_t failed = 0;
+	for (auto &t : cases) {
+		bool wanted = argc < 2;
+		for (int i = 1; i < argc; ++i) wanted = wanted || t.first == argv[i];
+		if (!wanted) continue;
+		Checks c;
+		t.second(c);
+		printf("%-12s %zu checks, %zu failed\n", t.first.c_str(), c.total, c.failed);
+		if (c.failed || !c.total) ++failed;
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,141 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace ShipEscape {
+
+// Persistent pool of workers running batches of indexed tasks. Each worker owns a queue
+// seeded with a contiguous chunk of the batch; it pops from the back of its own queue and,
+// once empty, steals from the front of the others, so uneven task lengths even out.
+class ThreadPool {
+	struct Queue {
+		std::mutex m;
+		std::deque<size_t> tasks;
+	};
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::mutex m;
+	std::condition_variable wake, done;
+	std::function<void(size_t)> job;
+	std::atomic<size_t> pending{0};
+	std::exception_ptr error;
+	size_t generation = 0;
+	bool stop = false;
+	bool pinned = false;
+
+ public:
+	// nbThreads = 0 uses every hardware thread; pin binds worker i to core i
+	explicit ThreadPool(size_t nbThreads = 0, bool pin = false) : pinned(pin) {
+		if (nbThreads == 0) nbThreads = std::max(1u, std::thread::hardware_concurrency());
+		for (size_t i = 0; i < nbThreads; ++i) queues.emplace_back(new Queue);
+		for (size_t i = 0; i < nbThreads; ++i) workers.emplace_back([this, i]() { work(i); });
+	}
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lk(m);
+			stop = true;
+		}
+		wake.notify_all();
+		for (auto &w : workers) w.join();
+	}
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	size_t size() const { return workers.size(); }
+
+	// calls f(i) for every i in [0, n) and returns once they are all done. The first
+	// exception thrown by a task is rethrown here.
+	void run(size_t n, std::function<void(size_t)> f) {
+		if (n == 0) return;
+		std::unique_lock<std::mutex> lk(m);
+		job = std::move(f);
+		error = nullptr;
+		pending = n;
+		size_t nq = queues.size();
+		for (size_t q = 0; q < nq; ++q) {
+			std::lock_guard<std::mutex> qlk(queues[q]->m);
+			for (size_t t = n * q / nq; t < n * (q + 1) / nq; ++t) queues[q]->tasks.push_back(t);
+		}
+		++generation;
+		wake.notify_all();
+		done.wait(lk, [this]() { return pending == 0; });
+		if (error) std::rethrow_exception(error);
+	}
+
+ private:
+	bool pop(size_t id, size_t &t) {
+		Queue &q = *queues[id];
+		std::lock_guard<std::mutex> lk(q.m);
+		if (q.tasks.empty()) return false;
+		t = q.tasks.back();
+		q.tasks.pop_back();
+		return true;
+	}
+
+	bool steal(size_t id, size_t &t) {
+		for (size_t k = 1; k < queues.size(); ++k) {
+			Queue &q = *queues[(id + k) % queues.size()];
+			std::lock_guard<std::mutex> lk(q.m);
+			if (!q.tasks.empty()) {
+				t = q.tasks.front();
+				q.tasks.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void pin(size_t id) {
+#ifdef __linux__
+		unsigned int nbCores = std::max(1u, std::thread::hardware_concurrency());
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(id % nbCores, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+		(void)id;
+#endif
+	}
+
+	void work(size_t id) {
+		if (pinned) pin(id);
+		size_t seen = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lk(m);
+				wake.wait(lk, [&]() { return stop || generation != seen; });
+				if (stop) return;
+				seen = generation;
+			}
+			size_t t;
+			while (pop(id, t) || steal(id, t)) {
+				try {
+					job(t);
+				} catch (...) {
+					std::lock_guard<std::mutex> lk(m);
+					if (!error) error = std::current_exception();
+				}
+				if (--pending == 0) {
+					std::lock_guard<std::mutex> lk(m);
+					done.notify_all();
+				}
+			}
+		}
+	}
+};
+}
+#endif
@@ -0,0 +1,124 @@
+#ifndef BATCHRENDERER_HPP
+#define BATCHRENDERER_HPP
+#include <QMatrix4x4>
+#include <QOpenGLBuffer>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QVector4D>
+#include <cstddef>
+#include <vector>
+#include "extern.h"
+#include "primitives/quad.hpp"
+#include "quadinstance.hpp"
+
+// Draws many quads with a single instanced draw call. Instances are accumulated with add()
+// and streamed to the GPU by draw(), which then starts a new batch. Uses the same unit quad
+// as RenderQuad, and the same gradient between color1 and color2 along UV.x.
+// Instancing needs OpenGL 3.3 or OpenGL ES 3.0. On older contexts the same shaders draw one
+// quad per call instead, the per instance attributes set as constant vertex attributes.
+class BatchRenderer {
+	enum Attributes { VERTEX = 0, POSROT = 2, SCALE = 3, COLOR1 = 4, COLOR2 = 5 };
+	QOpenGLShaderProgram shader;
+	Quad quad;
+	QOpenGLBuffer instanceBuffer;
+	QOpenGLFunctions *GL = nullptr;
+	QOpenGLExtraFunctions *EGL = nullptr;
+	bool instanced = false;
+	int viewLocation = -1;
+	std::vector<QuadInstance> instances;
+
+ public:
+	BatchRenderer() : instanceBuffer(QOpenGLBuffer::VertexBuffer) {}
+
+	void load(const QString &vs, const QString &fs) {
+		QOpenGLContext *context = QOpenGLContext::currentContext();
+		GL = context->functions();
+		EGL = context->extraFunctions();
+		instanced = context->format().version() >= qMakePair(3, context->isOpenGLES() ? 0 : 3);
+		shader.addShaderFromSourceFile(QOpenGLShader::Vertex, vs);
+		shader.addShaderFromSourceFile(QOpenGLShader::Fragment, fs);
+		shader.bindAttributeLocation("vertex", VERTEX);
+		shader.bindAttributeLocation("posRot", POSROT);
+		shader.bindAttributeLocation("scale", SCALE);
+		shader.bindAttributeLocation("color1", COLOR1);
+		shader.bindAttributeLocation("color2", COLOR2);
+		shader.link();
+		viewLocation = shader.uniformLocation("view");
+		quad.load(shader);
+
+		if (!instanced) return;
+		shader.bind();
+		quad.vao.bind();
+		instanceBuffer.create();
+		instanceBuffer.setUsagePattern(QOpenGLBuffer::StreamDraw);
+		instanceBuffer.bind();
+		const int stride = sizeof(QuadInstance);
+		setInstanceAttribute(POSROT, offsetof(QuadInstance, x), 4, stride);
+		setInstanceAttribute(SCALE, offsetof(QuadInstance, sx), 2, stride);
+		setInstanceAttribute(COLOR1, offsetof(QuadInstance, color1), 4, stride);
+		setInstanceAttribute(COLOR2, offsetof(QuadInstance, color2), 4, stride);
+		quad.vao.release();
+		instanceBuffer.release();
+		shader.release();
+	}
+
+	void add(const QuadInstance &q) { instances.push_back(q); }
+	void add(float x, float y, float z, float angle, float sx, float sy, const QVector4D &c1,
+	         const QVector4D &c2) {
+		instances.push_back(QuadInstance{x, y, z, angle, sx, sy, {c1.x(), c1.y(), c1.z(), c1.w()},
+		                                 {c2.x(), c2.y(), c2.z(), c2.w()}});
+	}
+	// room for n more instances, to be filled directly (e.g. from a particle pool)
+	QuadInstance *append(size_t n) {
+		size_t first = instances.size();
+		instances.resize(first + n);
+		return instances.data() + first;
+	}
+	size_t size() const { return instances.size(); }
+
+	// draws every instance added since the last draw, then empties the batch
+	void draw(const QMatrix4x4 &view) {
+		if (instances.empty()) return;
+		if (!instanced) {
+			drawEach(view);
+			return;
+		}
+		shader.bind();
+		quad.vao.bind();
+		instanceBuffer.bind();
+		instanceBuffer.allocate(instances.data(),
+		                        static_cast<int>(instances.size() * sizeof(QuadInstance)));
+		shader.setUniformValue(viewLocation, view);
+		EGL->glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(instances.size()));
+		instanceBuffer.release();
+		quad.vao.release();
+		shader.release();
+		instances.clear();
+	}
+
+ private:
+	void drawEach(const QMatrix4x4 &view) {
+		shader.bind();
+		quad.vao.bind();
+		shader.setUniformValue(viewLocation, view);
+		for (const QuadInstance &q : instances) {
+			shader.setAttributeValue(POSROT, q.x, q.y, q.z, q.angle);
+			shader.setAttributeValue(SCALE, q.sx, q.sy);
+			shader.setAttributeValue(COLOR1, q.color1, 4, 1);
+			shader.setAttributeValue(COLOR2, q.color2, 4, 1);
+			GL->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		}
+		quad.vao.release();
+		shader.release();
+		instances.clear();
+	}
+
+	void setInstanceAttribute(int location, size_t offset, int size, int stride) {
+		shader.enableAttributeArray(location);
+		shader.setAttributeBuffer(location, GL_FLOAT, static_cast<int>(offset), size, stride);
+		EGL->glVertexAttribDivisor(location, 1);
+	}
+};
+#endif
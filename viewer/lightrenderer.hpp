@@ -0,0 +1,70 @@
+#ifndef LIGHTRENDERER_HPP
+#define LIGHTRENDERER_HPP
+#include <QMatrix4x4>
+#include <QOpenGLBuffer>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLVertexArrayObject>
+#include <QVector2D>
+#include <QVector4D>
+#include <vector>
+#include "extern.h"
+
+// Draws a lit region given as a triangle fan (origin first, as computed by
+// ShipEscape::Visibility), fading from color1 at the origin to color2 at radius.
+class LightRenderer {
+	QOpenGLShaderProgram shader;
+	QOpenGLVertexArrayObject vao;
+	QOpenGLBuffer vbuf;
+	int viewLoc = -1, originLoc = -1, radiusLoc = -1, color1Loc = -1, color2Loc = -1;
+	std::vector<float> vertices;
+
+ public:
+	LightRenderer() : vbuf(QOpenGLBuffer::VertexBuffer) {}
+	void load(const QString &vs, const QString &fs) {
+		shader.addShaderFromSourceFile(QOpenGLShader::Vertex, vs);
+		shader.addShaderFromSourceFile(QOpenGLShader::Fragment, fs);
+		shader.bindAttributeLocation("vertex", 0);
+		shader.link();
+		viewLoc = shader.uniformLocation("view");
+		originLoc = shader.uniformLocation("origin");
+		radiusLoc = shader.uniformLocation("radius");
+		color1Loc = shader.uniformLocation("color1");
+		color2Loc = shader.uniformLocation("color2");
+		shader.bind();
+		vao.create();
+		vao.bind();
+		vbuf.create();
+		vbuf.setUsagePattern(QOpenGLBuffer::StreamDraw);
+		vbuf.bind();
+		shader.enableAttributeArray(0);
+		shader.setAttributeBuffer(0, GL_FLOAT, 0, 2);
+		vao.release();
+		vbuf.release();
+		shader.release();
+	}
+
+	template <typename P>
+	void draw(const std::vector<P> &fan, double radius, const QMatrix4x4 &view,
+	          const QVector4D &color1, const QVector4D &color2) {
+		if (fan.size() < 3) return;
+		vertices.resize(2 * fan.size());
+		for (size_t i = 0; i < fan.size(); ++i) {
+			vertices[2 * i] = fan[i].x;
+			vertices[2 * i + 1] = fan[i].y;
+		}
+		shader.bind();
+		vao.bind();
+		vbuf.bind();
+		vbuf.allocate(vertices.data(), static_cast<int>(vertices.size() * sizeof(float)));
+		shader.setUniformValue(viewLoc, view);
+		shader.setUniformValue(originLoc, QVector2D(fan[0].x, fan[0].y));
+		shader.setUniformValue(radiusLoc, static_cast<float>(radius));
+		shader.setUniformValue(color1Loc, color1);
+		shader.setUniformValue(color2Loc, color2);
+		GL->glDrawArrays(GL_TRIANGLE_FAN, 0, static_cast<GLsizei>(fan.size()));
+		vbuf.release();
+		vao.release();
+		shader.release();
+	}
+};
+#endif
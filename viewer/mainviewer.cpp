@@ -1,29 +1,126 @@
 
+#include <QtCore/QMetaObject>
 #include <QtCore/qmath.h>
 #include <QtGui/QGuiApplication>
 #include <QtGui/QMatrix4x4>
 #include <QtGui/QOpenGLShaderProgram>
 #include <QtGui/QScreen>
+#include <cstdlib>
+#include <cstring>
+#include "../replay.hpp"
 #include "../ship.hpp"
+#include "../visibility.hpp"
 #include "shipwindow.hpp"
 
-int main(int argc, char **argv) {
-	ShipEscape::World w;
+// usage: shipEscape [options]                 play with the keyboard (space, h, l)
+//        shipEscape [options] --replay file   play a recorded run back
+//          right / left: seek 10s forward / backward, r: restart
+// options: --speed x    simulated seconds per second (default 1)
+//          --uncapped   simulate as fast as possible
+//          --thread     simulate on a separate thread
+// in both modes up / down double / halve the speed, u toggles uncapped, p pauses
+struct ViewerOptions {
+	double speed = 1.0;
+	bool uncapped = false;
+	bool threaded = false;
+	const char *replay = nullptr;
+};
+
+// keys controlling the simulation speed, shared by both modes
+static bool speedKey(FixedStepLoop &loop, int key) {
+	switch (key) {
+		case Qt::Key_Up:
+			loop.speed = std::min(loop.speed * 2.0, 1024.0);
+			return true;
+		case Qt::Key_Down:
+			loop.speed = std::max(loop.speed * 0.5, 1.0 / 64.0);
+			return true;
+		case Qt::Key_U:
+			loop.uncapped = !loop.uncapped;
+			return true;
+		case Qt::Key_P:
+			loop.paused = !loop.paused;
+			return true;
+		default:
+			return false;
+	}
+}
+
+template <typename W> static void setup(W &window, const ViewerOptions &opt) {
+	window.loop.speed = opt.speed;
+	window.loop.uncapped = opt.uncapped;
+	if (opt.threaded) window.runInThread();
+	// instanced batches need 3.3 (see BatchRenderer), the shaders the compatibility profile
 	QSurfaceFormat f;
+	f.setVersion(3, 3);
+	f.setProfile(QSurfaceFormat::CompatibilityProfile);
 	f.setSamples(8);
+	window.setFormat(f);
+	window.resize(800, 800);
+	window.show();
+	window.setAnimating(true);
+}
+
+static int playReplay(QGuiApplication &app, const ViewerOptions &opt) {
+	ShipEscape::ReplayPlayer player;
+	if (!player.load(opt.replay)) {
+		std::cerr << "can't read replay " << opt.replay << std::endl;
+		return 1;
+	}
+	const size_t tenSeconds = static_cast<size_t>(10.0 / player.timeStep());
+	ShipWindow<ShipEscape::World> window(player.world, [&]() { player.advance(); });
+	window.keyboardEnabled = false;
+	window.onKeyPress = [&](int key) {
+		if (speedKey(window.loop, key)) return;
+		switch (key) {
+			case Qt::Key_Right:
+				player.seek(player.position() + tenSeconds);
+				break;
+			case Qt::Key_Left:
+				player.seek(player.position() > tenSeconds ? player.position() - tenSeconds : 0);
+				break;
+			case Qt::Key_R:
+				player.rewind();
+				break;
+			default:
+				break;
+		}
+	};
+	setup(window, opt);
+	return app.exec();
+}
+
+int main(int argc, char **argv) {
 	QGuiApplication app(argc, argv);
+	ViewerOptions opt;
+	for (int i = 1; i < argc; ++i) {
+		bool hasValue = i + 1 < argc;
+		if (!strcmp(argv[i], "--replay") && hasValue)
+			opt.replay = argv[++i];
+		else if (!strcmp(argv[i], "--speed") && hasValue)
+			opt.speed = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--uncapped"))
+			opt.uncapped = true;
+		else if (!strcmp(argv[i], "--thread"))
+			opt.threaded = true;
+	}
+	if (opt.replay) return playReplay(app, opt);
+
+	ShipEscape::World w;
+	bool over = false;
 	ShipWindow<decltype(w)> window(w, [&]() {
-		if (w.collided || w.countdown <= 0) {
+		if (over) return;
+		if (w.finished()) {
 			std::cerr << "SCORE = " << w.ships.at(0).position.y << std::endl;
-			exit(0);
+			// this may run on the simulation thread: let the event loop return, and the
+			// window stop it, rather than exit under its feet
+			over = true;
+			QMetaObject::invokeMethod(&app, "quit", Qt::QueuedConnection);
+			return;
 		}
 		w.update();
 	});
-	window.setFormat(f);
-	window.resize(800, 800);
-	window.show();
-
-	window.setAnimating(true);
-
+	window.onKeyPress = [&](int key) { speedKey(window.loop, key); };
+	setup(window, opt);
 	return app.exec();
 }
@@ -0,0 +1,99 @@
+#ifndef PARTICLEPOOL_HPP
+#define PARTICLEPOOL_HPP
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <random>
+#include <vector>
+#include "quadinstance.hpp"
+
+// Fixed capacity particle system, stored as structure of arrays so that integration is a
+// few plain float loops the compiler can vectorize. Live particles are kept packed at the
+// front: dead ones are swap-removed, and once the pool is full new particles overwrite
+// slots in ring order. Nothing is allocated after construction.
+class ParticlePool {
+	std::vector<float> x, y, vx, vy, age;
+	size_t n = 0;
+	size_t ring = 0;  // next slot to overwrite when full
+
+ public:
+	explicit ParticlePool(size_t capacity = 4096)
+	    : x(capacity), y(capacity), vx(capacity), vy(capacity), age(capacity) {}
+
+	size_t size() const { return n; }
+	size_t capacity() const { return x.size(); }
+	void clear() { n = 0; }
+
+	void spawn(float px, float py, float pvx, float pvy) {
+		size_t i = n;
+		if (n < capacity()) {
+			++n;
+		} else {
+			i = ring;
+			ring = (ring + 1) % capacity();
+		}
+		x[i] = px;
+		y[i] = py;
+		vx[i] = pvx;
+		vy[i] = pvy;
+		age[i] = 0;
+	}
+
+	// moves and ages every particle, then kills each one with probability killProba
+	template <typename RNG> void update(float dt, float killProba, RNG &generator) {
+		float *__restrict px = x.data();
+		float *__restrict py = y.data();
+		const float *__restrict pvx = vx.data();
+		const float *__restrict pvy = vy.data();
+		float *__restrict pa = age.data();
+		for (size_t i = 0; i < n; ++i) {
+			px[i] += pvx[i] * dt;
+			py[i] += pvy[i] * dt;
+			pa[i] += dt;
+		}
+		std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+		// backwards, so that the particle swapped in has already been tested
+		for (size_t i = n; i-- > 0;) {
+			if (dist(generator) < killProba) remove(i);
+		}
+	}
+
+	// writes one instance per particle: a disc of the given size whose hue shifts with age.
+	// Newer particles are drawn on top.
+	void instances(QuadInstance *out, float size) const {
+		for (size_t i = 0; i < n; ++i) {
+			float c = std::min(age[i] / 0.7f, 1.0f);
+			float rgb[3];
+			hueToRgb(0.55f * c + 0.8f * (1.0f - c), rgb);
+			QuadInstance &q = out[i];
+			q.x = x[i];
+			q.y = y[i];
+			q.z = -1.0f / (1.0f + age[i]);
+			q.angle = 0;
+			q.sx = q.sy = size;
+			for (int k = 0; k < 3; ++k) q.color1[k] = q.color2[k] = rgb[k];
+			q.color1[3] = 1.0f;
+			q.color2[3] = 0.0f;
+		}
+	}
+
+ private:
+	void remove(size_t i) {
+		--n;
+		x[i] = x[n];
+		y[i] = y[n];
+		vx[i] = vx[n];
+		vy[i] = vy[n];
+		age[i] = age[n];
+	}
+
+	// fully saturated and bright color of hue h in [0, 1]
+	static void hueToRgb(float h, float *rgb) {
+		const float offset[3] = {6.0f, 4.0f, 2.0f};
+		for (int k = 0; k < 3; ++k) {
+			float p = std::fabs(std::fmod(h * 6.0f + offset[k], 6.0f) - 3.0f);
+			rgb[k] = std::min(std::max(p - 1.0f, 0.0f), 1.0f);
+		}
+	}
+};
+#endif
@@ -0,0 +1,13 @@
+#ifndef QUADINSTANCE_HPP
+#define QUADINSTANCE_HPP
+
+// one quad of a batch, laid out as the per instance attributes of instanced.vert. Kept apart
+// from BatchRenderer so that what fills batches builds without Qt.
+struct QuadInstance {
+	float x, y, z;
+	float angle;   // counter clockwise, in radians
+	float sx, sy;  // same as QMatrix4x4::scale on the unit quad
+	float color1[4];
+	float color2[4];
+};
+#endif
@@ -6,6 +6,9 @@
 class RenderQuad {
 	QOpenGLShaderProgram shader;
 	Quad quad;
+	// uniform locations, looked up once at load (-1 when the shader doesn't use one)
+	int modelLoc = -1, viewLoc = -1, color1Loc = -1, color2Loc = -1, colorLoc = -1, texLoc = -1,
+	    addedColorLoc = -1;
 
  public:
 	RenderQuad(){};
@@ -13,6 +16,13 @@ class RenderQuad {
 		shader.addShaderFromSourceFile(QOpenGLShader::Vertex, vs);
 		shader.addShaderFromSourceFile(QOpenGLShader::Fragment, fs);
 		shader.link();
+		modelLoc = shader.uniformLocation("model");
+		viewLoc = shader.uniformLocation("view");
+		color1Loc = shader.uniformLocation("color1");
+		color2Loc = shader.uniformLocation("color2");
+		colorLoc = shader.uniformLocation("color");
+		texLoc = shader.uniformLocation("tex");
+		addedColorLoc = shader.uniformLocation("addedColor");
 		quad.load(shader);
 	}
 
@@ -20,10 +30,10 @@ class RenderQuad {
 	          const QVector4D &color2) {
 		shader.bind();
 		quad.vao.bind();
-		shader.setUniformValue(shader.uniformLocation("model"), model);
-		shader.setUniformValue(shader.uniformLocation("view"), view);
-		shader.setUniformValue(shader.uniformLocation("color1"), color1);
-		shader.setUniformValue(shader.uniformLocation("color2"), color2);
+		shader.setUniformValue(modelLoc, model);
+		shader.setUniformValue(viewLoc, view);
+		shader.setUniformValue(color1Loc, color1);
+		shader.setUniformValue(color2Loc, color2);
 		GL->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 		quad.vao.release();
 		shader.release();
@@ -31,9 +41,9 @@ class RenderQuad {
 	void draw(const QMatrix4x4 &model, const QMatrix4x4 &view, const QVector3D &color) {
 		shader.bind();
 		quad.vao.bind();
-		shader.setUniformValue(shader.uniformLocation("model"), model);
-		shader.setUniformValue(shader.uniformLocation("view"), view);
-		shader.setUniformValue(shader.uniformLocation("color"), color);
+		shader.setUniformValue(modelLoc, model);
+		shader.setUniformValue(viewLoc, view);
+		shader.setUniformValue(colorLoc, color);
 		GL->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 		quad.vao.release();
 		shader.release();
@@ -44,10 +54,10 @@ class RenderQuad {
 		quad.vao.bind();
 		GL->glActiveTexture(GL_TEXTURE0);
 		GL->glBindTexture(GL_TEXTURE_2D, tex);
-		shader.setUniformValue(shader.uniformLocation("tex"), 0);
-		shader.setUniformValue(shader.uniformLocation("model"), model);
-		shader.setUniformValue(shader.uniformLocation("view"), view);
-		shader.setUniformValue(shader.uniformLocation("addedColor"), addedColor);
+		shader.setUniformValue(texLoc, 0);
+		shader.setUniformValue(modelLoc, model);
+		shader.setUniformValue(viewLoc, view);
+		shader.setUniformValue(addedColorLoc, addedColor);
 		GL->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 		quad.vao.release();
 		shader.release();
@@ -0,0 +1,12 @@
+varying vec2 UV;
+varying vec4 c1;
+varying vec4 c2;
+
+float sql(vec2 v){
+	return dot(v,v);
+}
+
+void main() {
+	float l = sql(UV - vec2(0.5));
+	gl_FragColor =  l <= 0.25 ? mix(c1, c2, l/0.25) : vec4(0);
+}
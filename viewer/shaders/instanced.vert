@@ -0,0 +1,21 @@
+attribute vec3 vertex;
+attribute vec4 posRot;
+attribute vec2 scale;
+attribute vec4 color1;
+attribute vec4 color2;
+
+varying highp vec2 UV;
+varying vec4 c1;
+varying vec4 c2;
+uniform highp mat4 view;
+
+void main(){
+	UV = (vertex.xy+vec2(1.0,1.0))*0.5;
+	c1 = color1;
+	c2 = color2;
+	vec2 p = vertex.xy*scale;
+	float c = cos(posRot.w);
+	float s = sin(posRot.w);
+	vec2 r = vec2(p.x*c - p.y*s, p.x*s + p.y*c);
+	gl_Position = view*vec4(r + posRot.xy, vertex.z + posRot.z, 1.0);
+}
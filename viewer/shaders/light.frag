@@ -0,0 +1,7 @@
+varying highp vec2 D;
+uniform vec4 color1;
+uniform vec4 color2;
+
+void main() {
+	gl_FragColor = mix(color1, color2, min(length(D), 1.0));
+}
@@ -0,0 +1,11 @@
+attribute vec2 vertex;
+
+varying highp vec2 D;
+uniform highp mat4 view;
+uniform highp vec2 origin;
+uniform highp float radius;
+
+void main(){
+	D = (vertex - origin) / radius;
+	gl_Position = view*vec4(vertex, 0.0, 1.0);
+}
@@ -0,0 +1,7 @@
+varying vec2 UV;
+varying vec4 c1;
+varying vec4 c2;
+
+void main() {
+	gl_FragColor =  mix(c1,c2,UV.x);
+}
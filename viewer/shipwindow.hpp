@@ -7,24 +7,18 @@
 #include <QPainter>
 #include <QVector2D>
 #include <chrono>
-#include <deque>
 #include <functional>
 #include <memory>
 #include <random>
 #include <sstream>
 #include <unordered_set>
+#include "batchrenderer.hpp"
 #include "extern.h"
+#include "lightrenderer.hpp"
 #include "openglwindow.h"
+#include "particlepool.hpp"
 #include "renderquad.hpp"
-
-struct Particle {
-	Particle(QVector2D p, QVector2D v,
-	         std::chrono::time_point<std::chrono::high_resolution_clock> T)
-	    : position(p), velocity(v), t(T){};
-	QVector2D position;
-	QVector2D velocity;
-	std::chrono::time_point<std::chrono::high_resolution_clock> t;
-};
+#include "simloop.hpp"
 
 template <typename World> class ShipWindow : public OpenGLWindow {
 	int screenCoef = 1.0;
@@ -32,8 +26,11 @@ template <typename World> class ShipWindow : public OpenGLWindow {
 	// Visual elements
 	std::unique_ptr<QOpenGLTexture> shipTex;
 	std::unique_ptr<QOpenGLTexture> bordTex;
-	RenderQuad spriteRenderer, circleRenderer, plainRenderer, particleRenderer;
-	std::deque<Particle> particles;
+	RenderQuad spriteRenderer;
+	BatchRenderer plainBatch, circleBatch;
+	ParticlePool particles;
+	LightRenderer lightRenderer;
+	ShipEscape::Visibility visibility;
 
 	// Stats
 	std::chrono::time_point<std::chrono::high_resolution_clock> t0;
@@ -43,20 +40,38 @@ template <typename World> class ShipWindow : public OpenGLWindow {
 	std::function<void()> updateLambda;
 	std::unordered_set<int> keyMap;
 
+	// what is drawn: the last simulation state, its ships interpolated from the step before
+	bool threaded = false;
+	std::unique_ptr<SimThread<World>> sim;
+	std::unique_ptr<World> shown;
+	std::vector<typename World::Ship> prevShips;
+	typename World::State curState;
+
 	QVector2D anchor, prevAnchor;
 
  public:
 	bool keyboardEnabled = true;
-	ShipWindow(World &w, std::function<void()> upl) : world(w), updateLambda(upl) {}
-	~ShipWindow() {}
+	std::function<void(int)> onKeyPress;  // optional, called with the Qt key code
+	// how fast the simulation runs; its dt is the world's
+	FixedStepLoop loop;
+	// updateLambda advances the world by one dt; it is called as many times per frame as
+	// loop says, from the simulation thread if runInThread() was called
+	ShipWindow(World &w, std::function<void()> upl) : world(w), updateLambda(upl) {
+		loop.dt = w.dt;
+	}
+	~ShipWindow() { sim.reset(); }
+
+	// steps the world on its own thread, started with the window. onKeyPress is then called
+	// from that thread too, so it may touch the world and loop but nothing else.
+	void runInThread() { threaded = true; }
 	void initialize() {
 		GL = QOpenGLContext::currentContext()->functions();
 		GL->initializeOpenGLFunctions();
 		generator.seed(t0.time_since_epoch().count());
 		spriteRenderer.load(":/shaders/sprite.vert", ":/shaders/sprite.frag");
-		circleRenderer.load(":/shaders/sprite.vert", ":/shaders/circle.frag");
-		plainRenderer.load(":/shaders/sprite.vert", ":/shaders/plain.frag");
-		particleRenderer.load(":/shaders/sprite.vert", ":/shaders/circle.frag");
+		plainBatch.load(":/shaders/instanced.vert", ":/shaders/plain_instanced.frag");
+		circleBatch.load(":/shaders/instanced.vert", ":/shaders/circle_instanced.frag");
+		lightRenderer.load(":/shaders/light.vert", ":/shaders/light.frag");
 		shipTex = std::unique_ptr<QOpenGLTexture>(
 		    new QOpenGLTexture(QImage(":/images/ship.png").mirrored()));
 		shipTex->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
@@ -64,17 +79,55 @@ template <typename World> class ShipWindow : public OpenGLWindow {
 		t0 = std::chrono::high_resolution_clock::now();
 		anchor = QVector2D(world.ships[0].position.x, world.ships[0].position.y);
 		prevAnchor = anchor;
+		shown.reset(new World(world.fork()));
+		prevShips = world.ships;
+		world.snapshot(curState);
+		if (threaded) {
+			sim.reset(new SimThread<World>(world, loop, [this]() { simStep(); }));
+			sim->start();
+		}
 	}
 
-	void processEvents() {
+	// one dt of simulation, keyboard included
+	void simStep() {
+		for (auto &s : world.ships) s.thrusting = false;
 		if (keyboardEnabled) {
 			if (keyMap.count(Qt::Key_Space)) world.ships.at(0).thrust(world.dt);
 			if (keyMap.count(Qt::Key_H)) world.ships.at(0).rotate(1.0, world.dt * 8.0);
 			if (keyMap.count(Qt::Key_L)) world.ships.at(0).rotate(-1.0, world.dt * 8.0);
 		}
+		updateLambda();
+	}
+
+	// brings shown to the instant between the last two states that matches this frame
+	void advance(double frameTime) {
+		double alpha;
+		if (sim) {
+			sim->read(prevShips, *shown, alpha);
+		} else {
+			loop.advance(frameTime, [&]() {
+				prevShips = world.ships;
+				simStep();
+			});
+			// one state per frame, whatever the number of steps, into the same buffers
+			world.snapshot(curState);
+			shown->copyFrom(curState);
+			alpha = loop.alpha();
+		}
+		if (prevShips.size() != shown->ships.size()) return;
+		for (size_t i = 0; i < prevShips.size(); ++i) {
+			auto &s = shown->ships[i];
+			const auto a = prevShips[i], b = s;
+			s.position = a.position * (1.0 - alpha) + b.position * alpha;
+			s.orientation = a.orientation * (1.0 - alpha) + b.orientation * alpha;
+			s.orientation.normalize();
+		}
+	}
+
+	void processEvents() {
+		const World &world = *shown;
 		for (auto &s : world.ships) {
 			if (s.thrusting) {
-				s.thrusting = false;
 				const unsigned int nbP = 10;
 				const double delta = 0.1;
 				const double baseSpeed = 40.0;
@@ -82,24 +135,36 @@ template <typename World> class ShipWindow : public OpenGLWindow {
 				uniform_real_distribution<double> distD(-delta, delta);
 				uniform_real_distribution<double> dist(-1.0, 1.0);
 				for (unsigned int i = 0; i < nbP; ++i) {
-					QVector2D shipPosition(world.ships.at(0).position.x,
-					                       world.ships.at(0).position.y);
-					auto direction = world.ships.at(0).orientation;
+					auto direction = s.orientation;
 					direction.rotate(distD(generator));
-					QVector2D dir(-direction.x, -direction.y);
-					particles.push_back(Particle(
-					    shipPosition + dir * (3.0 + dist(generator) * 1.0),
-					    dir * (baseSpeed + dist(generator) * speedVariation * baseSpeed), t0));
+					double offset = 3.0 + dist(generator) * 1.0;
+					double speed = baseSpeed + dist(generator) * speedVariation * baseSpeed;
+					particles.spawn(s.position.x - direction.x * offset,
+					                s.position.y - direction.y * offset, -direction.x * speed,
+					                -direction.y * speed);
 				}
 			}
 		}
 	}
 
 	void handleKey(QKeyEvent *event) {
-		if (event->type() == QEvent::KeyPress)
-			keyMap.insert(event->key());
-		else if (event->type() == QEvent::KeyRelease)
-			keyMap.erase(event->key());
+		int key = event->key();
+		if (event->type() == QEvent::KeyPress) {
+			bool repeat = event->isAutoRepeat();
+			postToSim([this, key, repeat]() {
+				keyMap.insert(key);
+				if (onKeyPress && !repeat) onKeyPress(key);
+			});
+		} else if (event->type() == QEvent::KeyRelease) {
+			postToSim([this, key]() { keyMap.erase(key); });
+		}
+	}
+	// keys belong to the simulation side
+	void postToSim(std::function<void()> f) {
+		if (sim)
+			sim->post(std::move(f));
+		else
+			f();
 	}
 
 	double prevL = 0;
@@ -110,8 +175,10 @@ template <typename World> class ShipWindow : public OpenGLWindow {
 		auto t1 = std::chrono::high_resolution_clock::now();
 		auto dur = std::chrono::duration<double>(t1 - t0);
 		t0 = std::chrono::high_resolution_clock::now();
-		updateLambda();
-		updateParticles(dur.count());
+		advance(dur.count());
+		// from here on, only the interpolated copy is drawn
+		const World &world = *shown;
+		particles.update(dur.count(), 0.05, generator);
 		processEvents();
 		clear();
 		// painter->begin();
@@ -140,46 +207,20 @@ template <typename World> class ShipWindow : public OpenGLWindow {
 		           (anchor.y() + (world.MAXH * 0.5 * scale)), 1, -1);
 		int currentGridCell = world.getGridPosition(shipPosition.y());
 
-		// ship lights
+		// ship lights: the exact lit region, within a pixel of the obstacles' outline
 		QVector4D color1(0.1, 0.24, 0.48, 0.2);
 		QVector4D color2(0.05, 0.12, 0.24, 0.0);
+		visibility.tolerance = pixelRatio * scale / retinaScale;
 		for (auto &s : world.ships) {
-			QVector2D sPosition(s.position.x, s.position.y);
-			double teta = M_PI * 2.0;
 			double maxDist = world.MAXH;
-			auto dir = s.orientation;
-			dir.rotate(-teta / 2.0);
-			double N = 1500;
-			for (int i = 0; i < N; ++i) {
-				QMatrix4x4 targetModel;
-				dir.rotate(teta / N);
-				dir.normalize();
-				QVector2D ori(dir.x, dir.y);
-				double angle = atan2(-dir.y, dir.x);
-				double dist = world.normalizedDistRay(dir, maxDist, s);
-				targetModel.translate(sPosition + ori * dist * 0.5);
-				targetModel.rotate((angle + M_PI * 0.5) * (180.0 / M_PI), QVector3D(0, 0, -1));
-				targetModel.scale(0.25, 0.5 * dist);
-				double v = 1.0 - dist / maxDist;
-				plainRenderer.draw(targetModel, view, color1, color2);
-			}
+			visibility.compute(world, s, maxDist);
+			lightRenderer.draw(visibility.fan, maxDist, view, color1, color2);
 		}
 
 		// particles
-		double pIndex = 0.0;
-		for (auto &p : particles) {
-			QMatrix4x4 pModel;
-			pModel.translate(p.position);
-			pModel.translate(0, 0, -pIndex++ / (double)particles.size());
-			pModel.scale(0.4, 0.4);
-			auto v = chrono::duration_cast<chrono::milliseconds>(t0 - p.t);
-			QColor cm =
-			    QColor::fromHsvF(mix(0.55, 0.8, min((double)v.count() / 700.0, 1.0)), 1.0, 1);
-			QVector4D color(cm.redF(), cm.greenF(), cm.blueF(), 1.0);
-			QVector4D color2 = color;
-			color2.setW(0.0);
-			particleRenderer.draw(pModel, view, color, color2);
-		}
+		particles.instances(circleBatch.append(particles.size()), 0.4);
+		circleBatch.draw(view);
+
 		// we draw all the ships
 		for (auto &s : world.ships) {
 			model = QMatrix4x4();
@@ -191,67 +232,44 @@ template <typename World> class ShipWindow : public OpenGLWindow {
 
 		// obstacles
 		const int viewField = 10;
+		const QVector4D oColor1(1, 0.7, 0.5, 1.0);
+		const QVector4D oColor2(1, 0.9, 0.6, 1.0);
 		for (int i = currentGridCell - viewField; i < currentGridCell + viewField; ++i) {
-			if (world.obstacles.count(i)) {
-				auto &om = world.obstacles[i];
-				for (auto &o : om) {
-					QMatrix4x4 cModel;
-					cModel.translate(o.center.x, o.center.y);
-					cModel.scale(o.radius, o.radius);
-					QVector4D color1(1, 0.7, 0.5, 1.0);
-					QVector4D color2(1, 0.9, 0.6, 1.0);
-					circleRenderer.draw(cModel, view, color1, color2);
-				}
+			if (auto *om = world.obstacles.find(i)) {
+				for (auto &o : *om)
+					circleBatch.add(o.center.x, o.center.y, 0, 0, o.radius, o.radius, oColor1, oColor2);
 			}
 		}
+		circleBatch.draw(view);
+
 		// walls
 		const double wallWidth = 50;
 		const QVector4D wColor1(.07, .3, .48, 1.0);
 		const QVector4D wColor2(.12, .5, .34, 1.0);
-		{
-			QMatrix4x4 wModel;
-			wModel.translate(-wallWidth, shipPosition.y());
-			wModel.scale(wallWidth, world.MAXH * 2);
-			plainRenderer.draw(wModel, view, wColor1, wColor2);
-		}
-		{
-			QMatrix4x4 wModel;
-			wModel.translate(world.W + wallWidth, shipPosition.y());
-			wModel.scale(wallWidth, world.MAXH * 2);
-			plainRenderer.draw(wModel, view, wColor2, wColor1);
-		}
+		plainBatch.add(-wallWidth, shipPosition.y(), 0, 0, wallWidth, world.MAXH * 2, wColor1,
+		               wColor2);
+		plainBatch.add(world.W + wallWidth, shipPosition.y(), 0, 0, wallWidth, world.MAXH * 2,
+		               wColor2, wColor1);
 
 		// doors
 		const double doorThickness = 0.3;
 		const QVector4D dColor1(.97, .0, .32, 1.0);
 		const QVector4D dColor2(.98, .8, .3, 1.0);
-		{
-			// closed one
-			QMatrix4x4 wModel;
-			wModel.translate(world.W * 0.5, world.prevReset);
-			wModel.scale(world.W * 0.5, doorThickness * 2.0);
-			plainRenderer.draw(wModel, view, dColor2, dColor2);
-		}
-
+		// the doors of the followed ship; closed one
+		const auto doors = world.doors(world.ships.at(0));
+		plainBatch.add(world.W * 0.5, doors.prevReset, 0, 0, world.W * 0.5, doorThickness * 2.0,
+		               dColor2, dColor2);
 		{
 			// opened one
-			double apertureSize = world.W * world.countdown / world.maxCountdown;
-			double closedSize = (world.W - apertureSize) * 0.5;
+			double closedSize = doors.closedSize;
 			// left
-			{
-				QMatrix4x4 wModel;
-				wModel.translate(closedSize * 0.5, world.nextReset);
-				wModel.scale(closedSize * 0.5, doorThickness);
-				plainRenderer.draw(wModel, view, dColor2, dColor1);
-			}
+			plainBatch.add(closedSize * 0.5, doors.nextReset, 0, 0, closedSize * 0.5, doorThickness,
+			               dColor2, dColor1);
 			// right
-			{
-				QMatrix4x4 wModel;
-				wModel.translate(world.W - closedSize * 0.5, world.nextReset);
-				wModel.scale(closedSize * 0.5, doorThickness);
-				plainRenderer.draw(wModel, view, dColor1, dColor2);
-			}
+			plainBatch.add(world.W - closedSize * 0.5, doors.nextReset, 0, 0, closedSize * 0.5,
+			               doorThickness, dColor1, dColor2);
 		}
+		plainBatch.draw(view);
 
 		QFont font("arial", 40);
 		painter->setFont(font);
@@ -264,19 +282,6 @@ template <typename World> class ShipWindow : public OpenGLWindow {
 		++frame;
 	}
 
-	void updateParticles(double dt) {
-		const double destProba = 0.05;
-		std::uniform_real_distribution<double> dist(0.0, 1.0);
-		auto new_end =
-		    std::remove_if(particles.begin(), particles.end(),
-		                   [&](const Particle &) { return dist(generator) < destProba; });
-		particles.erase(new_end, particles.end());
-		for (auto &p : particles) {
-			p.position += p.velocity * dt;
-		}
-	}
-	double mix(double a, double b, double c) { return a * c + b * (1.0 - c); }
-
 	void clear() {
 		GL->glDepthMask(true);
 		GL->glClearColor(0.05, 0.12, 0.24, 1.0);
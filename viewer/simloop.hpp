@@ -0,0 +1,144 @@
+#ifndef SIMLOOP_HPP
+#define SIMLOOP_HPP
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Turns the real time elapsed between frames into a whole number of fixed dt simulation
+// steps, so that simulated time no longer depends on vsync or on how long a frame takes
+// to paint. What is left over is kept for the next frame and tells the renderer how far
+// to interpolate between the last two states.
+struct FixedStepLoop {
+	double dt = 1.0 / 60.0;
+	double speed = 1.0;           // simulated seconds per real second
+	bool paused = false;
+	bool uncapped = false;        // step as much as fits in frameBudget instead
+	double frameBudget = 0.012;   // seconds of stepping per call when uncapped
+	double maxFrameTime = 0.25;   // longer hiccups are dropped rather than caught up
+	double accumulator = 0;
+
+	// calls step() for every step due after frameTime seconds, returns how many were run
+	template <typename F> size_t advance(double frameTime, F &&step) {
+		typedef std::chrono::steady_clock clock;
+		if (paused) return 0;
+		size_t n = 0;
+		if (uncapped) {
+			auto t0 = clock::now();
+			do {
+				step();
+				++n;
+			} while (std::chrono::duration<double>(clock::now() - t0).count() < frameBudget);
+			accumulator = dt;
+			return n;
+		}
+		accumulator += std::min(frameTime, maxFrameTime) * speed;
+		for (; accumulator >= dt; accumulator -= dt, ++n) step();
+		return n;
+	}
+
+	// position of the displayed instant between the previous and the current state, in [0, 1]
+	double alpha() const { return std::min(accumulator / dt, 1.0); }
+};
+
+// Runs a FixedStepLoop on its own thread, against the world it was given. The renderer reads
+// the last published state together with the ships one step before it, and never touches the
+// live world. A state is published once the renderer has read the previous one, so at most
+// once per rendered frame, into the same buffers every time: publishing neither allocates
+// nor leaves the world sharing its obstacle cells. Anything else that must mutate the world
+// (key presses, seeks) is posted and runs on the simulation thread between steps.
+template <typename World> class SimThread {
+ public:
+	typedef typename World::State State;
+	typedef typename World::Ship Ship;
+
+	SimThread(World &w, FixedStepLoop &l, std::function<void()> s)
+	    : world(w), loop(l), step(s), before(w.ships), previous(w.ships) {
+		w.snapshot(current);
+	}
+	~SimThread() { stop(); }
+
+	void start() {
+		quit = false;
+		thread = std::thread([this]() { run(); });
+	}
+	void stop() {
+		quit = true;
+		if (thread.joinable()) thread.join();
+	}
+
+	void post(std::function<void()> f) {
+		std::lock_guard<std::mutex> lock(tasksMutex);
+		tasks.push_back(std::move(f));
+	}
+
+	// the ships one step before the published state, that state, and how far to interpolate
+	// between them. Both are copied into the caller's storage.
+	void read(std::vector<Ship> &prev, World &cur, double &alpha) {
+		std::lock_guard<std::mutex> lock(stateMutex);
+		prev = previous;
+		cur.copyFrom(current);
+		alpha = publishedAlpha;
+		wanted = true;
+	}
+
+ private:
+	World &world;
+	FixedStepLoop &loop;
+	std::function<void()> step;
+	std::thread thread;
+	std::atomic<bool> quit{false};
+	std::mutex tasksMutex, stateMutex;
+	std::deque<std::function<void()>> tasks;
+	std::vector<Ship> before, previous;  // ships before the last step, on each side
+	State current;
+	double publishedAlpha = 1.0;
+	bool wanted = true;        // the renderer has read what was last published
+	bool unpublished = false;  // the world changed since then
+
+	// runs what was posted, returns whether there was anything
+	bool runTasks() {
+		std::deque<std::function<void()>> pending;
+		{
+			std::lock_guard<std::mutex> lock(tasksMutex);
+			pending.swap(tasks);
+		}
+		for (auto &f : pending) f();
+		return !pending.empty();
+	}
+
+	void publish() {
+		std::lock_guard<std::mutex> lock(stateMutex);
+		// until it is read, the published state keeps the alpha it was published with
+		if (unpublished && !wanted) return;
+		if (unpublished) {
+			previous = before;
+			world.snapshot(current);
+			unpublished = wanted = false;
+		}
+		publishedAlpha = loop.alpha();
+	}
+
+	void run() {
+		typedef std::chrono::steady_clock clock;
+		auto t0 = clock::now();
+		while (!quit) {
+			if (runTasks()) unpublished = true;
+			auto t1 = clock::now();
+			double frameTime = std::chrono::duration<double>(t1 - t0).count();
+			t0 = t1;
+			size_t n = loop.advance(frameTime, [&]() {
+				before = world.ships;
+				step();
+			});
+			if (n) unpublished = true;
+			publish();
+			// in real time there is nothing to do until the next step is due
+			if (!n && !loop.uncapped) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+};
+#endif
@@ -0,0 +1,323 @@
+#ifndef VISIBILITY_HPP
+#define VISIBILITY_HPP
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <vector>
+#include "ship.hpp"
+
+namespace ShipEscape {
+
+// Exact region lit from a point, i.e. what the ship's lasers would see if there were
+// infinitely many of them. The boundary is found by an angular sweep: between two
+// consecutive events (circle tangents, segment ends, crossings of two primitives or of a
+// primitive and the light range) a single wall, door, obstacle or the range limit is the
+// nearest, so each span only has to be resolved once. Straight parts are exact, arcs are
+// sampled so that along any ray from the origin the polygon is within tolerance of the
+// real curve, grazing rays included. The one place where it differs from castRay more is
+// the frame before the doors reset, with the ship already past the next door: castRay
+// still stops rays at that door's line behind the ship, the region doesn't.
+// Buffers are kept between calls, so computing the region of every frame doesn't allocate
+// once they have grown.
+struct Visibility {
+	double tolerance = 0.01;
+	// triangle fan: origin first, then the boundary counter clockwise
+	vector<V> fan;
+
+	// region lit from the ship within maxDist, between angles from and from + aperture
+	const vector<V> &compute(const World &w, const Ship &s, double maxDist,
+	                         double from = -M_PI, double aperture = 2.0 * M_PI) {
+		return compute(w, w.obstacles, s.position, w.doors(s), maxDist, from, aperture);
+	}
+	const vector<V> &compute(const World &w, const World::ObstacleMap &obs, const V &origin,
+	                         const Doors &d, double maxDist, double from = -M_PI,
+	                         double aperture = 2.0 * M_PI) {
+		o = origin;
+		range = maxDist;
+		start = from;
+		span = min(aperture, 2.0 * M_PI);
+		gather(w, obs, d);
+		buildEvents();
+		sweep();
+		return fan;
+	}
+
+	// surface of the lit region
+	double area() const {
+		double a = 0;
+		for (size_t i = 2; i < fan.size(); ++i) a += cross(fan[i - 1] - o, fan[i] - o);
+		return 0.5 * a;
+	}
+
+	// whether p is lit, i.e. in free space and in sight of the origin
+	bool contains(const V &p) const {
+		if (fan.size() < 3) return false;
+		for (size_t i = 2; i < fan.size(); ++i) {
+			V a = fan[i - 1] - o, b = fan[i] - o, q = p - o;
+			if (cross(a, q) >= 0 && cross(q, b) >= 0 && cross(b - a, q - a) >= 0 &&
+			    cross(a, b) > 0)
+				return true;
+		}
+		return false;
+	}
+
+ private:
+	struct Primitive {
+		bool circle;
+		V a, b;  // segment ends, or center and (radius, 0)
+		double lo, hi;
+	};
+	enum EventType { BEGIN, END, SPLIT };
+	struct Event {
+		double t;
+		EventType type;
+		int p;
+		bool operator<(const Event &e) const { return t < e.t || (t == e.t && type < e.type); }
+	};
+
+	V o;
+	double range = 0, start = 0, span = 0;
+	vector<Primitive> prims;
+	vector<int> cells;  // cell of each circle, walls and doors first with INT_MAX
+	vector<Event> events;
+	vector<int> active;
+
+	static double cross(const V &a, const V &b) { return a.x * b.y - a.y * b.x; }
+	// angle relative to start, in [0, 2pi)
+	double rel(double angle) const {
+		double t = fmod(angle - start, 2.0 * M_PI);
+		return t < 0 ? t + 2.0 * M_PI : t;
+	}
+	double relOf(const V &p) const { return rel(atan2(p.y - o.y, p.x - o.x)); }
+
+	void addSegment(const V &a, const V &b) {
+		V ra = a - o, rb = b - o;
+		double c = cross(ra, rb);
+		if (fabs(c) < 1e-12) return;  // seen edge on
+		if (c < 0) return addSegment(b, a);
+		// nearest point of the segment beyond range: can't be lit
+		V ab = b - a;
+		double k = max(0.0, min(1.0, -ra.dot(ab) / ab.sqLength()));
+		if ((ra + ab * k).sqLength() >= range * range) return;
+		double lo = relOf(a);
+		prims.push_back(Primitive{false, a, b, lo, lo + atan2(c, ra.dot(rb))});
+		cells.push_back(INT_MAX);
+	}
+
+	void gather(const World &w, const World::ObstacleMap &obs, const Doors &d) {
+		prims.clear();
+		cells.clear();
+		// walls and doors, clipped to the light range
+		double bottom = o.y - range, top = o.y + range;
+		double left = max(0.0, o.x - range), right = min(w.W, o.x + range);
+		addSegment(V(0, bottom), V(0, top));
+		addSegment(V(w.W, bottom), V(w.W, top));
+		if (d.prevReset > bottom) addSegment(V(left, d.prevReset), V(right, d.prevReset));
+		if (d.nextReset < top) {
+			if (d.closedSize > left) addSegment(V(left, d.nextReset), V(d.closedSize, d.nextReset));
+			if (w.W - d.closedSize < right)
+				addSegment(V(w.W - d.closedSize, d.nextReset), V(right, d.nextReset));
+		}
+		// obstacles of the same window castRay looks at
+		int gridCell = w.getGridPosition(o.y);
+		int visibility = w.gridVisibility();
+		for (int c = gridCell - visibility; c <= gridCell + visibility; ++c) {
+			auto *cell = obs.find(c);
+			if (!cell) continue;
+			for (auto &ci : *cell) {
+				V rc = ci.center - o;
+				double dist = sqrt(rc.sqLength());
+				// circles around the origin are invisible to rays, as in hitCircles
+				if (dist <= ci.radius || dist - ci.radius >= range) continue;
+				double half = asin(ci.radius / dist);
+				double lo = rel(atan2(rc.y, rc.x) - half);
+				prims.push_back(Primitive{true, ci.center, V(ci.radius, 0), lo, lo + 2.0 * half});
+				cells.push_back(c);
+			}
+		}
+	}
+
+	void addBounds(int p, double lo, double hi) {
+		lo = max(lo, 0.0);
+		hi = min(hi, span);
+		if (lo > hi) return;
+		events.push_back(Event{lo, BEGIN, p});
+		events.push_back(Event{hi, END, p});
+	}
+	void addSplit(const V &p) {
+		V rp = p - o;
+		if (rp.sqLength() > range * range * (1.0 + 1e-9)) return;
+		double t = relOf(p);
+		if (t < span) events.push_back(Event{t, SPLIT, -1});
+	}
+
+	// intersections of the line of a segment (or circle) with a circle, split at each
+	void splitCircle(const Primitive &p, const V &c, double r) {
+		if (p.circle) {
+			V dc = p.a - c;
+			double r0 = p.b.x, dd = dc.sqLength(), dist = sqrt(dd);
+			if (dist >= r + r0 || dist <= fabs(r - r0) || dist == 0) return;
+			double k = (r * r - r0 * r0 + dd) / (2.0 * dist);
+			double h = sqrt(max(0.0, r * r - k * k));
+			V u = dc / dist, n(-u.y, u.x);
+			addSplit(c + u * k + n * h);
+			addSplit(c + u * k - n * h);
+		} else {
+			V ab = p.b - p.a, ac = p.a - c;
+			double A = ab.sqLength(), B = 2.0 * ab.dot(ac), C = ac.sqLength() - r * r;
+			double disc = B * B - 4.0 * A * C;
+			if (disc <= 0) return;
+			double s = sqrt(disc);
+			for (double k : {(-B - s) / (2.0 * A), (-B + s) / (2.0 * A)})
+				if (k > 0 && k < 1) addSplit(p.a + ab * k);
+		}
+	}
+	void splitSegments(const Primitive &p, const Primitive &q) {
+		V r = p.b - p.a, s = q.b - q.a, qp = q.a - p.a;
+		double den = cross(r, s);
+		if (den == 0) return;
+		double k = cross(qp, s) / den, l = cross(qp, r) / den;
+		if (k >= 0 && k <= 1 && l >= 0 && l <= 1) addSplit(p.a + r * k);
+	}
+
+	void buildEvents() {
+		events.clear();
+		for (size_t i = 0; i < prims.size(); ++i) {
+			const Primitive &p = prims[i];
+			addBounds(static_cast<int>(i), p.lo, p.hi);
+			addBounds(static_cast<int>(i), p.lo - 2.0 * M_PI, p.hi - 2.0 * M_PI);
+			// where it goes in or out of range
+			splitCircle(p, o, range);
+			// where it crosses another primitive. Circles are collected cell by cell and
+			// are smaller than a cell, so only neighbour cells can overlap.
+			for (size_t j = i + 1; j < prims.size(); ++j) {
+				const Primitive &q = prims[j];
+				if (p.circle && cells[j] > cells[i] + 1) break;
+				if (q.circle)
+					splitCircle(p, q.a, q.b.x);
+				else
+					splitSegments(p, q);
+			}
+		}
+		events.push_back(Event{0, SPLIT, -1});
+		events.push_back(Event{span, SPLIT, -1});
+		sort(events.begin(), events.end());
+	}
+
+	// distance along dir to primitive p, or infinity if it is missed
+	double hit(const Primitive &p, const V &dir) const {
+		if (p.circle) {
+			V rc = p.a - o;
+			double along = rc.dot(dir), side = cross(dir, rc), r = p.b.x;
+			double disc = r * r - side * side;
+			if (along <= 0 || disc < 0) return numeric_limits<double>::infinity();
+			return along - sqrt(disc);
+		}
+		V s = p.b - p.a;
+		double den = cross(dir, s);
+		if (den == 0) return numeric_limits<double>::infinity();
+		double dist = cross(p.a - o, s) / den;
+		return dist > 0 ? dist : numeric_limits<double>::infinity();
+	}
+	// same, but the ray is assumed to graze p at worst (span bounds are tangents)
+	V hitPoint(const Primitive &p, double t) const {
+		V dir(cos(start + t), sin(start + t));
+		if (p.circle) {
+			V rc = p.a - o;
+			double side = cross(dir, rc), r = p.b.x;
+			return o + dir * (rc.dot(dir) - sqrt(max(0.0, r * r - side * side)));
+		}
+		V s = p.b - p.a;
+		return o + dir * (cross(p.a - o, s) / cross(dir, s));
+	}
+
+	void push(const V &p) {
+		if (fan.size() > 1 && (fan.back() - p).sqLength() < 1e-24) return;
+		fan.push_back(p);
+	}
+	// arc of the circle (c, r) from angle a0, turning by da, sampled within tolerance
+	void arc(const V &c, double r, double a0, double da) {
+		double step = tolerance < r ? 2.0 * acos(1.0 - tolerance / r) : M_PI * 0.5;
+		int n = max(1, static_cast<int>(ceil(fabs(da) / step)));
+		V p0 = c + V(cos(a0), sin(a0)) * r;
+		push(p0);
+		for (int i = 1; i <= n; ++i) {
+			double a = a0 + da * i / n;
+			V p1 = c + V(cos(a), sin(a)) * r;
+			refine(c, r, a - da / n, da / n, p0, p1, 0);
+			p0 = p1;
+		}
+	}
+	// a chord within tolerance of the curve can still be far from it along the rays that
+	// graze the circle: halve it until the ray through the middle of the arc meets the
+	// chord within tolerance. That error grows like the square root of the arc near a
+	// tangent, where its largest value is at most 1.21 times the one in the middle.
+	void refine(const V &c, double r, double a0, double da, const V &p0, const V &p1,
+	            int depth) {
+		double a = a0 + 0.5 * da;
+		V m = c + V(cos(a), sin(a)) * r, rm = m - o, chord = p1 - p0;
+		double den = cross(rm, chord);
+		double err = den != 0 ? fabs(1.0 - cross(p0 - o, chord) / den) * sqrt(rm.sqLength())
+		                      : numeric_limits<double>::infinity();
+		if (err * 1.25 > tolerance && depth < 40) {
+			refine(c, r, a0, 0.5 * da, p0, m, depth + 1);
+			refine(c, r, a, 0.5 * da, m, p1, depth + 1);
+			return;
+		}
+		push(p1);
+	}
+
+	void sweep() {
+		fan.clear();
+		fan.push_back(o);
+		active.clear();
+		size_t e = 0;
+		while (e < events.size()) {
+			double t0 = events[e].t;
+			for (; e < events.size() && events[e].t == t0; ++e) {
+				if (events[e].type == BEGIN) {
+					active.push_back(events[e].p);
+				} else if (events[e].type == END) {
+					auto it = find(active.begin(), active.end(), events[e].p);
+					if (it != active.end()) {
+						*it = active.back();
+						active.pop_back();
+					}
+				}
+			}
+			if (e == events.size()) break;
+			double t1 = events[e].t;
+			if (t1 - t0 < 1e-12) continue;
+			// the nearest primitive in the middle of the span is the nearest in all of it
+			double mid = start + 0.5 * (t0 + t1);
+			V dir(cos(mid), sin(mid));
+			int nearest = -1;
+			double closest = range;
+			for (int p : active) {
+				double dist = hit(prims[p], dir);
+				if (dist < closest) {
+					closest = dist;
+					nearest = p;
+				}
+			}
+			if (nearest < 0) {
+				arc(o, range, start + t0, t1 - t0);
+				continue;
+			}
+			const Primitive &p = prims[nearest];
+			V p0 = hitPoint(p, t0), p1 = hitPoint(p, t1);
+			if (!p.circle) {
+				push(p0);
+				push(p1);
+				continue;
+			}
+			double a0 = atan2(p0.y - p.a.y, p0.x - p.a.x);
+			double da = atan2(p1.y - p.a.y, p1.x - p.a.x) - a0;
+			if (da > M_PI) da -= 2.0 * M_PI;
+			if (da < -M_PI) da += 2.0 * M_PI;
+			arc(p.a, p.b.x, a0, da);
+		}
+	}
+};
+}
+#endif
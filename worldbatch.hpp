@@ -0,0 +1,227 @@
+#ifndef WORLDBATCH_HPP
+#define WORLDBATCH_HPP
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "ship.hpp"
+
+namespace ShipEscape {
+
+// N independent single-ship worlds stored as structure of arrays and stepped in lockstep.
+// Every lane follows exactly the same trajectory as a separate World with the same
+// seedOffset receiving the same rotate / thrust calls, as long as the compiler doesn't fuse
+// multiplies and adds differently in the two (the build and BasicV::rotate turn that off, see
+// CMakeLists.txt).
+struct WorldBatch {
+	World params;     // course parameters shared by all lanes (W, dt, doors, density...)
+	Ship shipParams;  // ship parameters and initial progress shared by all lanes
+
+	// ship state
+	vector<double> px, py, vx, vy, ox, oy, fx, fy;
+	// course state
+	vector<double> currentTime, countdown, nextReset, prevReset, coef;
+	vector<uint8_t> collided;
+	vector<uint8_t> active;  // lanes still running; finished lanes are masked out of update()
+	vector<int> seedOffset;
+	vector<World::ObstacleMap> obstacles;
+	// scratch of update(): where each lane started the step and the doors it approached
+	vector<double> fromX, fromY;
+	vector<Doors> approached;
+
+	WorldBatch(size_t n, const World &p = World()) : params(p) {
+		shipParams = params.ships.at(0);
+		resize(n);
+	}
+
+	size_t size() const { return px.size(); }
+
+	void resize(size_t n) {
+		for (auto *a : {&px, &py, &vx, &vy, &ox, &oy, &fx, &fy, &currentTime, &countdown,
+		                &nextReset, &prevReset, &coef})
+			a->resize(n);
+		collided.resize(n);
+		active.resize(n);
+		fromX.resize(n);
+		fromY.resize(n);
+		approached.resize(n);
+		seedOffset.resize(n);
+		obstacles.resize(n);
+		for (size_t i = 0; i < n; ++i) reset(i, params.seedOffset);
+	}
+
+	// puts a lane back in the initial state of params, on the course of the given seedOffset
+	void reset(size_t i, int offset) {
+		px[i] = shipParams.position.x;
+		py[i] = shipParams.position.y;
+		vx[i] = shipParams.velocity.x;
+		vy[i] = shipParams.velocity.y;
+		fx[i] = shipParams.forces.x;
+		fy[i] = shipParams.forces.y;
+		ox[i] = shipParams.orientation.x;
+		oy[i] = shipParams.orientation.y;
+		currentTime[i] = params.currentTime;
+		countdown[i] = shipParams.countdown;
+		nextReset[i] = shipParams.nextReset;
+		prevReset[i] = shipParams.prevReset;
+		coef[i] = shipParams.coef;
+		collided[i] = shipParams.collided;
+		active[i] = true;
+		seedOffset[i] = offset;
+		obstacles[i].clear();
+	}
+
+	double W() const { return params.W; }
+	bool finished(size_t i) const { return collided[i] || countdown[i] <= 0; }
+	size_t nbActive() const {
+		size_t n = 0;
+		for (auto a : active) n += a;
+		return n;
+	}
+
+	V position(size_t i) const { return V(px[i], py[i]); }
+	V orientation(size_t i) const { return V(ox[i], oy[i]); }
+	Ship ship(size_t i) const {
+		Ship s = shipParams;
+		s.position = position(i);
+		s.velocity = V(vx[i], vy[i]);
+		s.forces = V(fx[i], fy[i]);
+		s.orientation = orientation(i);
+		return s;
+	}
+
+	// actuators, same semantics as Ship::rotate and Ship::thrust
+	void rotate(size_t i, double dir, double dt) {
+		Ship s = shipParams;
+		s.orientation = orientation(i);
+		s.rotate(dir, dt);
+		ox[i] = s.orientation.x;
+		oy[i] = s.orientation.y;
+	}
+	void thrust(size_t i, double dt) {
+		double actualQ = shipParams.thrustPower * dt;
+		fx[i] = fx[i] + ox[i] * actualQ;
+		fy[i] = fy[i] + oy[i] * actualQ;
+	}
+
+	Doors doors(size_t i) const {
+		double apertureSize = params.W * countdown[i] / params.maxCountdown;
+		return Doors{prevReset[i], nextReset[i], (params.W - apertureSize) * 0.5};
+	}
+	double normalizedDistRay(size_t i, V direction, double maxDist) const {
+		return params.castRay(obstacles[i], position(i), direction, maxDist, doors(i));
+	}
+	void castFan(size_t i, const V *dirs, size_t n, double maxDist, double *out) const {
+		params.castFan(obstacles[i], position(i), dirs, n, maxDist, doors(i), out);
+	}
+
+	// one World::update() on every active lane. Inactive lanes are masked with selects rather
+	// than skipped; see move() for what vectorizes.
+	void update() {
+		const size_t n = size();
+		const double dt = params.dt;
+		std::copy(px.begin(), px.end(), fromX.begin());
+		std::copy(py.begin(), py.end(), fromY.begin());
+		// the branch on dt is taken once, outside the loop
+		if (dt == shipParams.referenceDt)
+			move<true>(n, dt, active.data(), ox.data(), oy.data(), fx.data(), fy.data(),
+			           px.data(), py.data(), vx.data(), vy.data(), currentTime.data(),
+			           countdown.data());
+		else
+			move<false>(n, dt, active.data(), ox.data(), oy.data(), fx.data(), fy.data(),
+			            px.data(), py.data(), vx.data(), vy.data(), currentTime.data(),
+			            countdown.data());
+
+		// doors
+		for (size_t i = 0; i < n; ++i) approached[i] = doors(i);
+		passDoors(n, active.data(), py.data(), nextReset.data(), prevReset.data(), coef.data(),
+		          countdown.data());
+
+		// collisions
+		for (size_t i = 0; i < n; ++i) {
+			if (!active[i]) continue;
+			params.fillObstacles(obstacles[i], py[i], seedOffset[i], prevReset[i]);
+			if (params.collides(obstacles[i], V(fromX[i], fromY[i]), position(i), approached[i],
+			                    doors(i)))
+				collided[i] = true;
+		}
+
+		double *__restrict fX = fx.data();
+		double *__restrict fY = fy.data();
+		uint8_t *__restrict act = active.data();
+		const uint8_t *__restrict col = collided.data();
+		const double *__restrict cd = countdown.data();
+		for (size_t i = 0; i < n; ++i) {
+			fX[i] = act[i] ? 0.0 : fX[i];
+			fY[i] = act[i] ? 0.0 : fY[i];
+			act[i] = (act[i] != 0) & (col[i] == 0) & (cd[i] > 0);
+		}
+	}
+
+ private:
+	// physics pass (Ship::updatePosition). The passes take their arrays as restrict parameters
+	// of functions kept out of line: inlined, or as locals of update(), gcc loses track of the
+	// restrict and gives up on the alias checks. Per -fopt-info-vec, this one and passDoors
+	// vectorize at the reference dt (other steps call pow) on targets with masked stores, that
+	// is with SHIPESCAPE_NATIVE on AVX2 or AVX-512. At the SSE2 baseline gcc turns the selects
+	// back into conditional stores and only the doors and mask loops of update() vectorize.
+	template <bool reference>
+	__attribute__((noinline))
+	void move(size_t n, double dt, const uint8_t *__restrict act, const double *__restrict oX,
+	          const double *__restrict oY, const double *__restrict fX, const double *__restrict fY,
+	          double *__restrict pX, double *__restrict pY, double *__restrict vX,
+	          double *__restrict vY, double *__restrict t, double *__restrict cd) const {
+		const double steps = dt / shipParams.referenceDt;
+		const double forceScale = shipParams.referenceDt / dt;
+		for (size_t i = 0; i < n; ++i) {
+			const bool a = act[i];
+			double vit = sqrt(vX[i] * vX[i] + vY[i] * vY[i]);
+			// a ship at rest keeps its velocity; dividing by 1 instead only avoids the NaN
+			double inv = vit > 0 ? vit : 1.0;
+			double nx = vX[i] / inv;
+			double ny = vY[i] / inv;
+			double d = nx * oX[i] + ny * oY[i];
+			double r = 0.0 < d ? d : 0.0;
+			double kx, ky;
+			if (reference) {
+				kx = oX[i] * vit * r * CONTROLE + vX[i] * (1.0 - CONTROLE * r);
+				ky = oY[i] * vit * r * CONTROLE + vY[i] * (1.0 - CONTROLE * r);
+			} else {
+				double k = 1.0 - pow(1.0 - CONTROLE * r, steps);
+				kx = oX[i] * vit * k + vX[i] * (1 - k);
+				ky = oY[i] * vit * k + vY[i] * (1 - k);
+			}
+			kx = vit > 0 ? kx : vX[i];
+			ky = vit > 0 ? ky : vY[i];
+			kx = kx + (fX[i] * forceScale - kx * FRICTION) * dt;
+			ky = ky + (fY[i] * forceScale - ky * FRICTION) * dt;
+			double x = pX[i] + kx * dt, y = pY[i] + ky * dt;
+			double time = t[i] + dt, countdown = cd[i] - dt;
+			vX[i] = a ? kx : vX[i];
+			vY[i] = a ? ky : vY[i];
+			pX[i] = a ? x : pX[i];
+			pY[i] = a ? y : pY[i];
+			t[i] = a ? time : t[i];
+			cd[i] = a ? countdown : cd[i];
+		}
+	}
+
+	// lanes past their next door get the following one (the reset of Ship::updatePosition)
+	__attribute__((noinline))
+	void passDoors(size_t n, const uint8_t *__restrict act, const double *__restrict pY,
+	               double *__restrict next, double *__restrict prev, double *__restrict cf,
+	               double *__restrict cd) const {
+		const double halfLength = shipParams.dimensions.y * 0.5;
+		const double step = params.step, increment = params.coefIncrement;
+		const double maxCountdown = params.maxCountdown;
+		for (size_t i = 0; i < n; ++i) {
+			const bool passed = (act[i] != 0) & (pY[i] >= next[i] + halfLength);
+			double reset = next[i] + step * cf[i], c = cf[i] + increment;
+			prev[i] = passed ? next[i] : prev[i];
+			next[i] = passed ? reset : next[i];
+			cf[i] = passed ? c : cf[i];
+			cd[i] = passed ? maxCountdown : cd[i];
+		}
+	}
+};
+}
+#endif